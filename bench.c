@@ -0,0 +1,172 @@
+/* Microbenchmarks for the hot paths of the shell. It is linked with
+ * libterminal.a, so the parser and executor are timed as the shell runs
+ * them.
+ *
+ * Every result is printed as one line of JSON on stdout:
+ *
+ *   {"bench":"parse_pipes","iterations":100000,"seconds":0.41,
+ *    "per_op_ns":2050.1,"mb_per_s":90.2}
+ *
+ * An argument scales the number of iterations, 1 by default.
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+
+#include "terminal.h"
+
+#define BENCH_LINE_SIZE 8192
+#define BENCH_PARSE_ITERATIONS 100000
+#define BENCH_SPAWN_ITERATIONS 2000
+#define BENCH_PIPELINE_BYTES "268435456"
+#define BENCH_PIPELINE_STAGES 4
+
+///////////////////////////////////////////////////////////////////////////////
+double bench_now( void ){
+  // Seconds on the monotonic clock
+  struct timespec now;
+
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+///////////////////////////////////////////////////////////////////////////////
+void bench_report( const char* name, long iterations, double seconds,
+    double bytes ){
+  // Prints one result, with a rate if the bench moved bytes
+  printf( "{\"bench\":\"%s\",\"iterations\":%ld,\"seconds\":%.6f,"
+    "\"per_op_ns\":%.1f", name, iterations, seconds,
+    seconds * 1e9 / iterations );
+  if ( bytes > 0 ){
+    printf( ",\"mb_per_s\":%.1f", bytes / seconds / 1e6 );
+  }
+  printf( "}\n" );
+  fflush( stdout );
+}
+///////////////////////////////////////////////////////////////////////////////
+void bench_parse( const char* name, const char* line, long iterations ){
+  // Tokenizes a line over and over through parse_line and command_out
+  static struct command_list list;
+  static char buffer[BENCH_LINE_SIZE];
+  size_t length = strlen( line ) + 1;
+  double start;
+  long i;
+
+  start = bench_now();
+  for( i = 0 ; i < iterations ; i++ ){
+    // The line is cut up in place, so each pass starts from a fresh copy
+    memcpy( buffer, line, length );
+    parse_line( buffer, &list );
+    command_list_clear( &list );
+  }
+  bench_report( name, iterations, bench_now() - start,
+    (double) iterations * (length - 1) );
+}
+///////////////////////////////////////////////////////////////////////////////
+void bench_run( const char* name, const char* line, long iterations,
+    double bytes ){
+  // Parses and runs a line as the shell loop does
+  static struct command_list list;
+  static char buffer[BENCH_LINE_SIZE];
+  size_t length = strlen( line ) + 1;
+  double start;
+  long i;
+
+  start = bench_now();
+  for( i = 0 ; i < iterations ; i++ ){
+    memcpy( buffer, line, length );
+    if ( parse_line( buffer, &list ) ){
+      proc_command_list( &list );
+    }
+    command_list_clear( &list );
+  }
+  bench_report( name, iterations, bench_now() - start, bytes * iterations );
+}
+///////////////////////////////////////////////////////////////////////////////
+void bench_idle( const char* name, const char* line, long iterations ){
+  // Times each run alone, refilling the workers in between as a prompt does
+  static struct command_list list;
+  static char buffer[BENCH_LINE_SIZE];
+  size_t length = strlen( line ) + 1;
+  double start, seconds = 0;
+  long i;
+
+  for( i = 0 ; i < iterations ; i++ ){
+    pool_refill();
+    start = bench_now();
+    memcpy( buffer, line, length );
+    if ( parse_line( buffer, &list ) ){
+      proc_command_list( &list );
+    }
+    command_list_clear( &list );
+    seconds += bench_now() - start;
+  }
+  bench_report( name, iterations, seconds, 0 );
+}
+///////////////////////////////////////////////////////////////////////////////
+int main( int argc, char* argv[] ){
+  // Runs every bench in turn
+  static char line[BENCH_LINE_SIZE];
+  static char name[64];
+  long scale;
+  int i, j, length;
+
+  scale = argc > 1 ? atol( argv[1] ) : 1;
+  if ( scale < 1 ){
+    scale = 1;
+  }
+
+  jobs_init( false );
+
+  // Tokenizer: long arguments, heavy quoting and many pipe symbols
+  length = 0;
+  for( i = 0 ; i < 200 ; i++ ){
+    length += sprintf( line + length, "argument%03d ", i );
+  }
+  strcpy( line + length, "\n" );
+  bench_parse( "parse_long_args", line, BENCH_PARSE_ITERATIONS * scale );
+
+  length = 0;
+  for( i = 0 ; i < 100 ; i++ ){
+    length += sprintf( line + length, "'single %d' \"dou\\\"ble\"\\ x ", i );
+  }
+  strcpy( line + length, "\n" );
+  bench_parse( "parse_quotes", line, BENCH_PARSE_ITERATIONS * scale );
+
+  length = 0;
+  for( i = 0 ; i < 100 ; i++ ){
+    length += sprintf( line + length, "cat -u < in%d | ", i );
+  }
+  strcpy( line + length, "cat > out\n" );
+  bench_parse( "parse_pipes", line, BENCH_PARSE_ITERATIONS * scale );
+
+  // Latency of starting and reaping one command, without the PATH search
+  bench_run( "spawn_true", "/bin/true\n", BENCH_SPAWN_ITERATIONS * scale, 0 );
+
+  // The same handed to a worker, the refill not counted as it is idle time
+  variable_set( WORKERS_ENV, strlen( WORKERS_ENV ), "1", false );
+  bench_idle( "spawn_true_workers", "/bin/true\n",
+    BENCH_SPAWN_ITERATIONS * scale );
+  variable_set( WORKERS_ENV, strlen( WORKERS_ENV ), "0", false );
+  pool_refill();
+
+  // Bytes pushed through 1 to N stages, head and then cats
+  for( i = 1 ; i <= BENCH_PIPELINE_STAGES ; i++ ){
+    length = sprintf( line, "head -c " BENCH_PIPELINE_BYTES " /dev/zero" );
+    for( j = 1 ; j < i ; j++ ){
+      length += sprintf( line + length, " | cat" );
+    }
+    strcpy( line + length, " > /dev/null\n" );
+    sprintf( name, "pipeline_%d_stages", i );
+    bench_run( name, line, scale, atof( BENCH_PIPELINE_BYTES ) );
+  }
+
+  // The longest pipeline again, with 1m pipes instead of the default
+  sprintf( name, "pipeline_%d_stages_1m", BENCH_PIPELINE_STAGES );
+  memmove( line + 12, line, strlen( line ) + 1 );
+  memcpy( line, "pipesize 1m ", 12 );
+  bench_run( name, line, scale, atof( BENCH_PIPELINE_BYTES ) );
+
+  return 0;
+}
@@ -12,6 +12,9 @@
 #ifndef TERMINAL_C
 #define TERMINAL_C
 
+// pipe2 and O_CLOEXEC
+#define _GNU_SOURCE
+
 #ifndef TERMINAL_H
  #include "terminal.h"
  #ifndef TERMINAL_H
@@ -23,687 +26,5160 @@
 #include<stdlib.h>
 #include<string.h>
 #include<stdbool.h>
+#include<stddef.h>
 
+#include<ctype.h>
+#include<dirent.h>
 #include<errno.h>
+#include<limits.h>
 #include<fcntl.h>
+#include<signal.h>
+#include<spawn.h>
+#include<sys/mman.h>
+#include<sys/resource.h>
+#include<sys/sendfile.h>
+#include<sys/socket.h>
+#include<sys/stat.h>
+#include<sys/time.h>
 #include<sys/types.h>
+#include<sys/uio.h>
+#include<time.h>
 #include<unistd.h>
 #include<wait.h>
 
+extern char **environ;
+
+// Everything the executor keeps between lines. There is one per process,
+// as the cwd, environment, signals and children are.
+static struct executor executor = { .trace_fd = -1 };
+
+// Commands run by the shell itself
+static const struct builtin builtins[] = {
+  { BG_STRING,       builtin_bg       },
+  { CD_STRING,       builtin_cd       },
+  { ECHO_STRING,     builtin_echo     },
+  { EXIT_STRING,     builtin_exit     },
+  { EXPORT_STRING,   builtin_export   },
+  { FALSE_STRING,    builtin_false    },
+  { FG_STRING,       builtin_fg       },
+  { HASH_STRING,     builtin_hash     },
+  { JOBS_STRING,     builtin_jobs     },
+  { PARALLEL_STRING, builtin_parallel },
+  { PCAT_STRING,     builtin_pcat     },
+  { PTEE_STRING,     builtin_ptee     },
+  { PWD_STRING,      builtin_pwd      },
+  { TRUE_STRING,     builtin_true     },
+  { UNSET_STRING,    builtin_unset    },
+  { WAIT_STRING,     builtin_wait     },
+  { NULL,            NULL             }
+};
+
 ///////////////////////////////////////////////////////////////////////////////
-int main(void){
-  return shell();
+#ifndef TERMINAL_LIBRARY
+int main(int argc, char* argv[]){
+  // An argument is a script file to run instead of stdin
+  return shell( argc > 1 ? argv[1] : NULL );
 }
+#endif
 ///////////////////////////////////////////////////////////////////////////////
-int shell(void){
+int shell( const char* script ){
   // This is the main function that will run the shell
   // Remember that output is 1 and input is 0
 
-  debug printf( LANGUAGE_SELECT, TERMLANG );
-
-  static enum pipe_flag flag_mode;
-  flag_mode = NO_PIPE;
+  // Stores input, either a terminal, a pipe or a whole file
+  struct reader reader;
+  char* input_buffer;
+  ssize_t input_length;
 
-  static bool set_file_input = false;
-  static bool set_file_output = false;
+  // Parsed line, a list of pipelines each with one stage per command
+  // between the pipe symbols
+  struct command_list line_list;
 
-  // Stores input
-  //static char input_buffer[BUFFER_SIZE];
-  static char input_buffer[BUFFER_SIZE];
-  purge_string(input_buffer, BUFFER_SIZE);
+  // Parsed form of a script, when it is cached
+  struct script_cache cache;
 
-  static char current_char;
-  static int previous_end, current_pos;
-  static bool is_command = true;
+  memset( &line_list, 0, sizeof(line_list) );
 
-  // Command Run String Buffer
-  unsigned int args_count = 0;
-  char *run_buffer_array[ARG_COUNT];
-  null_run_array(run_buffer_array, ARG_COUNT);
-  char *io_pipe_array[2];
-  null_run_array(io_pipe_array,2);
+  trace_open();
 
-  // io_pipe_array
-  // [0] will contain the input file  or 0 if there is none
-  // [1] will contain the output file or 0 if there is none
-
-  // run_buffer_array
-  // [0..] will contain the args for argv
+  if ( reader_open( &reader, script ) == -1 ){
+    fprintf( stderr, SCRIPT_OPEN_ERROR, script, strerror(errno) );
+    return 1;
+  }
+  trace( TRACE_START, 0, script, reader.interactive );
 
-  // Creating pipes
-  int pfda[2];
-  int pfdb[2];
+  jobs_init( reader.interactive );
+  pool_refill();
 
-  if ( pipe(pfda) == -1 ){
-    syserror( PFD_OPEN_ERROR );
+  // A script that has been run before goes straight from its table
+  if ( script != NULL && variable_value( CACHE_ENV ) != NULL &&
+      script_cache_open( &cache, script, &reader ) == 0 ){
+    script_cache_run( &cache, &line_list );
+    script_cache_close( &cache );
+    command_list_free( &line_list );
+    reader_close( &reader );
+    return executor.status;
   }
-  if ( pipe(pfdb) == -1 ){
-    syserror( PFD_OPEN_ERROR );
-  }
-
-  debug_batch printf( "->Starting batch mode\n" );
 
   // Shell Loop
   while(1){
 
-    // Ask for input
-    printf( PROMPT_STRING );
-    fgets(input_buffer, sizeof(input_buffer), stdin);
-    debug printf( DEBUG_STRING_CUR_INPUT, input_buffer);
+    // Report background jobs that have finished or stopped
+    jobs_update();
+    jobs_notify();
+
+    // Ask for input, batch input gets no prompt. Workers are forked while
+    // the user types, not on the way to a command
+    if ( reader.interactive ){
+      printf( PROMPT_STRING );
+      fflush( stdout );
+      pool_refill();
+    }
+    input_length = reader_getline( &reader, &input_buffer );
 
-    debug_batch printf( "%s\n", input_buffer );
+    // Ctrl+D or the end of a batch file
+    if ( input_length == -1 ){
+      break;
+    }
+    trace( TRACE_LINE, 0, NULL, input_length );
 
     if ( input_buffer[0] == '\n' ){
       continue;
     }
 
-    // Set the starting position for string parsing
-    current_pos = 0;
-    previous_end = -1;
+    // A syntax error is status 2, as in sh
+    if ( !parse_line( input_buffer, &line_list ) ){
+      command_list_clear( &line_list );
+      executor.status = 2;
+      continue;
+    }
+    heredoc_read( &line_list, &reader );
 
-    check_ctrl_d( input_buffer, BUFFER_SIZE );
+    // Start every stage of each pipeline at once, letting the children
+    // see stdin from the next line on
+    reader_release( &reader );
+    proc_command_list( &line_list );
+    reader_resume( &reader );
 
-    // This outer loop will jump to the next argument
-    while( (current_char = input_buffer[current_pos]) ){
+  }// End of Shell Loop
 
-      current_char = remove_whitespace( input_buffer,
-        &previous_end, &current_pos );
+  // End
+  trace( TRACE_END, 0, NULL, executor.status );
+  command_list_free( &line_list );
+  reader_close( &reader );
+  return executor.status;
+}
+///////////////////////////////////////////////////////////////////////////////
+bool parse_line( char* line, struct command_list* list ){
+  // Cuts a line up into the pipelines of the list
 
-      /* Break into the 6 base cases
-       * We first try to parse for a pipe BEFORE we parse the next input.
-       * We will process pipes BEFORE we process the input, so we will know if
-       * we have an input file or output file
-       */
+  // Cuts the line into words in place
+  struct tokenizer tokenizer;
+  enum token_type token;
+  char* word;
+  bool is_command = true;
+  bool syntax_error = false;
+  bool process;
 
-      if ( current_char == '\n' ){
-        debug printf( DEBUG_STRING_NEWLINE_FOUND );
-        // Check flags that are missing // No need
-        break;
-      }
+  struct pipeline* pipeline;
+  struct stage* stage;
+  struct redirect* redirect;
+  struct timespec start, end;
+  int first = list->count;
+  int i;
 
-      if ( current_char == '|' ){
-        debug printf( DEBUG_STRING_PIPE_FOUND );
-        previous_end += 1;
-        current_pos  += 1;
-        current_char = remove_whitespace( input_buffer,
-          &previous_end, &current_pos );
+  clock_gettime( CLOCK_MONOTONIC, &start );
 
-        if ( flag_mode == NO_PIPE )
-          flag_mode = PIPE_START;
+  // Set the starting position for string parsing
+  tokenizer_start( &tokenizer, line );
+  tokenizer.quiet = list->quiet;
+  pipeline = command_list_add_pipeline( list );
+  stage = pipeline_add_stage( pipeline, &list->arena );
 
-        proc_fork(pfda, pfdb, run_buffer_array, io_pipe_array, args_count, &flag_mode);
-        is_command = true;
-      }
+  // This outer loop will jump to the next token
+  while( !syntax_error &&
+      (token = next_token( &tokenizer, &word )) != TOKEN_END ){
 
-      else if ( current_char == '<' ){
-        debug printf( DEBUG_STRING_LESS_FOUND );
-        previous_end += 1;
-        current_pos  += 1;
-        current_char = remove_whitespace( input_buffer,
-          &previous_end, &current_pos );
+    trace( TRACE_TOKEN, 0, token == TOKEN_WORD ? word : NULL, token );
 
-        // If we hit an end of line before we get the filename, assume bad input
-        if ( current_char == '\n' ){
-          printf( UNEXPECTED_EOL );
+    switch( token ){
+      case TOKEN_WORD:
+        // time before a pipeline is not a command but asks for a report
+        if ( pipeline->count == 1 && !pipeline->timed &&
+            stage_empty( stage ) && strcmp( word, TIME_STRING ) == 0 ){
+          pipeline->timed = true;
           break;
         }
-
-        set_file_input = true;
-      }
-
-      else if ( current_char == '>' ){
-        debug printf( DEBUG_STRING_MORE_FOUND );
-        previous_end += 1;
-        current_pos  += 1;
-        current_char = remove_whitespace( input_buffer,
-          &previous_end, &current_pos );
-
-        // If we hit an end of line before we get the filename, assume bad input
-        if ( current_char == '\n' ){
-          printf( UNEXPECTED_EOL );
+        // So is pipesize, which sets the size of the pipeline's pipes
+        if ( pipeline->count == 1 && pipeline->pipe_size == 0 &&
+            stage_empty( stage ) && strcmp( word, PIPESIZE_STRING ) == 0 ){
+          if ( next_token( &tokenizer, &word ) != TOKEN_WORD ||
+              (pipeline->pipe_size = parse_size( word )) == 0 ){
+            if ( !list->quiet ){
+              fprintf( stderr, PIPE_SIZE_INVALID, PIPESIZE_STRING );
+            }
+            syntax_error = true;
+          }
           break;
         }
+        // NAME=value before the command is kept for its environment
+        if ( is_command && variable_name_length( word ) > 0 &&
+            word[variable_name_length( word )] == '=' ){
+          stage_add_assignment( stage, word, &list->arena );
+          break;
+        }
+        command_out( word, &is_command, stage, &list->arena );
+        break;
 
-        set_file_output = true;
-      }
-
-      // Parse Input
-      // Case A Start with '
-      if ( current_char == '\'' ){
-        debug printf( DEBUG_STRING_NEWLINE_DELIMIT );
-        previous_end +=1;
-        current_pos += 1;
-
-        while( (current_char = input_buffer[current_pos]) != '\'' ){
-          if ( current_char == '\0' ){
-            printf( UNEXPECTED_EOL );
-            break;
+      case TOKEN_PIPE:
+        if ( stage_empty( stage ) ){
+          if ( !list->quiet ){
+            printf( UNEXPECTED_TOKEN, "|" );
           }
-          // Ignore escaped character
-          else if ( current_char == '\\' ){
-            current_pos += 1;
+          syntax_error = true;
+          break;
+        }
+        // The whole line is parsed before anything is forked, so a pipe
+        // only moves us on to the next stage
+        stage = pipeline_add_stage( pipeline, &list->arena );
+        is_command = true;
+        break;
+
+      case TOKEN_AMP:
+      case TOKEN_SEMI:
+      case TOKEN_AND:
+      case TOKEN_OR:
+        if ( stage_empty( stage ) ){
+          if ( !list->quiet ){
+            printf( UNEXPECTED_TOKEN, token == TOKEN_AMP ? "&" :
+              token == TOKEN_SEMI ? ";" : token == TOKEN_AND ? "&&" : "||" );
           }
-          current_pos += 1;
+          syntax_error = true;
+          break;
         }
+        // Ends a pipeline, which runs in the background after &. The next
+        // one runs after && or || only if this one succeeds or fails.
+        pipeline->background = token == TOKEN_AMP;
+        pipeline = command_list_add_pipeline( list );
+        stage = pipeline_add_stage( pipeline, &list->arena );
+        pipeline->run_if = token == TOKEN_AND ? RUN_ON_SUCCESS :
+          token == TOKEN_OR ? RUN_ON_FAILURE : RUN_ALWAYS;
+        is_command = true;
+        break;
+
+      case TOKEN_REDIRECT:
+        redirect = stage_add_redirect( stage, &list->arena );
+        redirect->type = tokenizer.redirect_type;
+        redirect->fd = tokenizer.redirect_fd;
 
-        // Check if we have a pipe before this string
-        if ( !set_file_input && !set_file_output ){
-          previous_end = command_out(input_buffer, previous_end,
-            current_pos,&is_command, run_buffer_array,&args_count);
+        // A process substitution has a command instead of a file name
+        process = redirect->type == REDIRECT_PROCESS_IN ||
+          redirect->type == REDIRECT_PROCESS_OUT;
+        if ( process ){
+          token = next_process( &tokenizer, &word );
         }
         else{
-          previous_end = modify_fin_fout(input_buffer, previous_end,
-            current_pos, set_file_input, io_pipe_array);
-          set_file_input = set_file_output = false;
+          token = next_token( &tokenizer, &word );
         }
-      }
 
-      // Case B start with "
-      else if ( current_char == '\"' ){
-        debug printf( DEBUG_STRING_QUOTE_DELIMIT );
-        previous_end +=1;
-        current_pos +=1;
+        // < <(cmd) and > >(cmd) put the command straight onto the fd
+        if ( token == TOKEN_REDIRECT &&
+            redirect->type <= REDIRECT_APPEND &&
+            (tokenizer.redirect_type == REDIRECT_PROCESS_IN ||
+            tokenizer.redirect_type == REDIRECT_PROCESS_OUT) ){
+          redirect->type = tokenizer.redirect_type;
+          token = next_process( &tokenizer, &word );
+        }
 
-        while( (current_char = input_buffer[current_pos]) != '\"' ){
-          if ( current_char == '\0' ){
+        // If we hit an end of line before we get the filename,
+        // assume bad input
+        if ( token != TOKEN_WORD ){
+          if ( !list->quiet ){
             printf( UNEXPECTED_EOL );
-            break;
-          }
-          else if ( current_char == '\\' ){
-            current_pos += 1;
           }
-          current_pos += 1;
+          syntax_error = true;
+          break;
         }
+        redirect->file = word;
 
-        // Check if we have a pipe before this string
-        if ( !set_file_input && !set_file_output ){
-          previous_end = command_out(input_buffer, previous_end,
-            current_pos,&is_command, run_buffer_array,&args_count);
-        }
-        else{
-          previous_end = modify_fin_fout(input_buffer, previous_end,
-            current_pos, set_file_input, io_pipe_array);
-          set_file_input = set_file_output = false;
+        // A copy names the fd it is taken from instead of a file
+        if ( redirect->type == REDIRECT_DUP ){
+          redirect->source = parse_fd( word, strlen( word ) );
+          if ( redirect->source == -1 ){
+            if ( !list->quiet ){
+              printf( BAD_FD, word );
+            }
+            syntax_error = true;
+          }
+          redirect->file = NULL;
         }
-      }
 
-      // Case C string
-      else{
-        debug printf( DEBUG_STRING_SPACE_DELIMIT );
-        while( (current_char = input_buffer[current_pos]) != ' ' ){
-          if ( current_char == '\0' || current_char == '\n' ||
-               current_char == '\"' || current_char == '\'' ||
-               current_char == '<'  || current_char == '>'  ||
-               current_char == '|'
-               )
-            break;
-          else if ( current_char == '\\' ){
-            current_pos += 1;
+        // The command is given /dev/fd/n as a word, n counting down from
+        // PROCESS_FD for each in the stage
+        if ( process ){
+          redirect->fd = PROCESS_FD;
+          for( i = 0 ; i < (int) stage->redirect_count - 1 ; i++ ){
+            if ( stage->redirects[i].type == REDIRECT_PROCESS_IN ||
+                stage->redirects[i].type == REDIRECT_PROCESS_OUT ){
+              redirect->fd -= 1;
+            }
           }
-          current_pos += 1;
+          word = (char *) arena_alloc( &list->arena,
+            sizeof(PROCESS_PATH) + REDIRECT_FD_DIGITS );
+          sprintf( word, PROCESS_PATH, redirect->fd );
+          command_out( word, &is_command, stage, &list->arena );
         }
 
-        // Check if we have a pipe before this string
-        if ( !set_file_input && !set_file_output ){
-          previous_end = command_out(input_buffer, previous_end,
-            current_pos,&is_command, run_buffer_array,&args_count);
-        }
-        else{
-          previous_end = modify_fin_fout(input_buffer, previous_end,
-            current_pos, set_file_input, io_pipe_array);
-          set_file_input = set_file_output = false;
+        // The body is read after the line, up to the delimiter as typed
+        if ( redirect->type == REDIRECT_HEREDOC ){
+          redirect->source = (tokenizer.quoted ? HEREDOC_QUOTED : 0) |
+            (tokenizer.strip_tabs ? HEREDOC_TABS : 0);
+          redirect->file = glob_literal( word, word + strlen( word ),
+            &list->arena );
         }
-      }
 
-      current_pos +=1;
-      debug printf( DEBUG_STRING_CUR_POS, current_pos );
-
-    }// End of current argument
+        // &>file is >file 2>&1
+        if ( redirect->fd == -1 ){
+          redirect->fd = 1;
+          redirect = stage_add_redirect( stage, &list->arena );
+          redirect->type = REDIRECT_DUP;
+          redirect->fd = 2;
+          redirect->source = 1;
+          redirect->file = NULL;
+        }
+        break;
 
-    // Set the right end pipe to the right terminal state
-    // and start last command in queue
-    if ( flag_mode == PIPE_CONTA || flag_mode == PIPE_START ){
-      flag_mode = PIPE_DRAINA;
-    }
-    else if ( flag_mode == PIPE_CONTB ){
-      flag_mode = PIPE_DRAINB;
+      default:
+        syntax_error = true;
+        break;
     }
+  }// End of current token
 
-    proc_fork(pfda, pfdb, run_buffer_array, io_pipe_array, args_count, &flag_mode);
-    is_command = true;
-    purge_string(input_buffer, BUFFER_SIZE);
+  // A pipe symbol, && or || needs a command after it
+  if ( !syntax_error && stage_empty( stage ) &&
+      (pipeline->count > 1 || pipeline->run_if != RUN_ALWAYS) ){
+    if ( !list->quiet ){
+      printf( UNEXPECTED_EOL );
+    }
+    syntax_error = true;
+  }
 
-  }// End of Shell Loop
+  // Nothing of a bad line is kept
+  if ( syntax_error ){
+    list->count = first;
+    return false;
+  }
 
-  // Close File Descriptors for parent
-  if ( close(pfda[0]) == -1 || close(pfda[1]) == -1 ||
-      close(pfdb[0]) == -1 || close(pfdb[1]) == -1 ){
-    syserror( CLOSE_PIPE_FAIL );
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  trace( TRACE_PARSE, 0, NULL, list->count - first );
+  for( i = first ; i < list->count ; i++ ){
+    list->pipelines[i].parse_time = time_elapsed( &start, &end );
   }
 
-  // End
-  return 0;
+  return true;
 }
 ///////////////////////////////////////////////////////////////////////////////
-void proc_fork( int* pfda, int* pfdb, char* run_buffer_array [],
-    char* io_pipe_array [], int arg_count, enum pipe_flag* _flags){
-  // Executes the fork exec and pipe commands
+int reader_open( struct reader* reader, const char* script ){
+  // Picks the input source and maps it if it is a regular file
+  struct stat info;
 
-  static char concat_string_buffer[BUFFER_SIZE*2];
+  reader->buffer = NULL;
+  reader->length = reader->capacity = reader->start = reader->scanned = 0;
+  reader->mapped = reader->eof = reader->shared = false;
+  reader->last_line = NULL;
+  reader->block = READ_BLOCK_SIZE;
 
-  int pid, status;
-  debug show_state( run_buffer_array, arg_count );
-  debug printf( FILE_IO );
-  debug show_io( io_pipe_array );
+  if ( script != NULL ){
+    // The children keep the shell's stdin, not the script
+    reader->fd = open( script, O_RDONLY | O_CLOEXEC );
+    if ( reader->fd == -1 ){
+      return -1;
+    }
+    reader->interactive = false;
+  }
+  else{
+    reader->fd = 0;
+    reader->interactive = isatty( 0 );
+  }
 
-  status = 0;
+  if ( !reader->interactive && fstat( reader->fd, &info ) == 0 &&
+      S_ISREG(info.st_mode) && info.st_size > 0 ){
+    // Private so the tokenizer can write into the lines
+    reader->buffer = (char *) mmap( NULL, info.st_size,
+      PROT_READ | PROT_WRITE, MAP_PRIVATE, reader->fd, 0 );
+    if ( reader->buffer != MAP_FAILED ){
+      madvise( reader->buffer, info.st_size, MADV_SEQUENTIAL );
+      reader->mapped = reader->eof = true;
+      reader->length = reader->capacity = info.st_size;
+      reader->shared = (reader->fd == 0);
+      if ( reader->shared ){
+        reader->start = lseek( 0, 0, SEEK_CUR );
+        if ( reader->start > reader->length ){
+          reader->start = reader->length;
+        }
+        reader->scanned = reader->start;
+      }
+      return 0;
+    }
+    reader->buffer = NULL;
+  }
 
-  if ( strcmp(EXIT_STRING, run_buffer_array[0]) == 0 ){
-    exit(0);
+  // A stdin pipe can not be wound back for the children, so no byte past
+  // the line is taken from them, as sh does
+  if ( reader->fd == 0 && !reader->interactive ){
+    reader->block = 1;
   }
 
-  debug printf( DEBUG_STRING_FORK_START );
+  return 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+ssize_t reader_getline( struct reader* reader, char** line ){
+  // Hands out the next line straight from the buffer
+  char* newline;
+  size_t length;
+  ssize_t status;
 
-  // Setting up the pipes correctly in the call
-  // No pipes in the call
-  if ( (*_flags) == NO_PIPE ){
-    debug printf ( DEBUG_STRING_NO_PIPE );
-    switch ( pid = fork() ){
-      case -1:
-        syserror( FORK_FAIL );
-        break;
-      case  0:
-        // Stdin
-        if ( io_pipe_array[0] != NULL ){
-          if ( close( 0 ) == -1 )
-            syserror( STDIN_CLOSE_ERROR );
-          status = open(io_pipe_array[0],  O_RDONLY | O_CREAT, 0644);
-          if ( status < 0 )
-            syserror( STDIN_OPEN_ERROR );
-          dup(status);
-        }
-
-        // Stdout
-        if ( io_pipe_array[1] != NULL ){
-          if ( close( 1 ) == -1 ){
-            syserror( STDOUT_CLOSE_ERROR );
-          }
-          status = open(io_pipe_array[1],  O_WRONLY | O_CREAT, 0644);
-          if ( status < 0 ){
-            syserror( STDIN_OPEN_ERROR );
-          }
-          dup(status);
-        }
+  while( 1 ){
+    newline = NULL;
+    if ( reader->scanned < reader->length ){
+      newline = (char *) memchr( reader->buffer + reader->scanned, '\n',
+        reader->length - reader->scanned );
+    }
 
-        if ( close( pfda[0] ) == -1 || close( pfda[1] ) == -1 ||
-            close( pfdb[0] ) == -1 || close( pfdb[1] ) == -1 ){
-          syserror( PFD_CLOSE_ERROR );
-        }
+    if ( newline != NULL ){
+      *line = reader->buffer + reader->start;
+      length = newline + 1 - *line;
+      reader->start = reader->scanned = reader->start + length;
+      return length;
+    }
+    reader->scanned = reader->length;
 
-        execvp( run_buffer_array[0], (char** ) run_buffer_array );
-        sprintf( concat_string_buffer, COMMAND_NOT_FOUND, run_buffer_array[0]);
-        syserror( concat_string_buffer );
-        break;
+    if ( reader->eof ){
+      break;
     }
-  }
-  // First pipe
-  else if ( (*_flags) == PIPE_START ){
-    debug printf ( DEBUG_STRING_PIPE_START );
-    switch ( pid = fork() ){
-      case -1:
-        syserror( FORK_FAIL );
-        break;
-      case  0:
-        // Stdin
-        if ( io_pipe_array[0] != NULL ){
-          if ( close( 0 ) == -1 ){
-            syserror( STDIN_CLOSE_ERROR );
-          }
-          status = open(io_pipe_array[0], O_RDONLY | O_CREAT, 0644);
-          if ( status < 0 ){
-            syserror( STDIN_OPEN_ERROR );
-          }
-          dup(status);
-        }
 
-        // Stdout
-        if ( close( 1 ) == -1 ){
-          syserror( STDOUT_CLOSE_ERROR );
-        }
-        dup(pfda[1]);
+    // Slide the partial line down and make room for another block
+    if ( reader->start > 0 ){
+      memmove( reader->buffer, reader->buffer + reader->start,
+        reader->length - reader->start );
+      reader->length -= reader->start;
+      reader->scanned -= reader->start;
+      reader->start = 0;
+    }
+    if ( reader->capacity - reader->length < READ_BLOCK_SIZE + 1 ){
+      reader->capacity = reader->capacity ?
+        reader->capacity * 2 : READ_BLOCK_SIZE + 1;
+      if ( reader->capacity - reader->length < READ_BLOCK_SIZE + 1 ){
+        reader->capacity = reader->length + READ_BLOCK_SIZE + 1;
+      }
+      reader->buffer = (char *) realloc( reader->buffer, reader->capacity );
+      if ( reader->buffer == NULL ){
+        syserror( OUT_OF_MEMORY );
+      }
+    }
 
-        if ( close( pfda[0] ) == -1 || close( pfda[1] ) == -1 ||
-            close( pfdb[0] ) == -1 || close( pfdb[1] ) == -1 ){
-          syserror( PFD_CLOSE_ERROR );
-        }
+    status = read( reader->fd, reader->buffer + reader->length,
+      reader->block );
+    if ( status == -1 && errno == EINTR ){
+      continue;
+    }
+    if ( status <= 0 ){
+      reader->eof = true;
+    }
+    else{
+      reader->length += status;
+    }
+  }
 
-        execvp( run_buffer_array[0], (char** ) run_buffer_array );
-        sprintf( concat_string_buffer, COMMAND_NOT_FOUND, run_buffer_array[0]);
-        syserror( concat_string_buffer );
-        break;
+  // The last line has no newline
+  if ( reader->start == reader->length ){
+    return -1;
+  }
+  length = reader->length - reader->start;
+  if ( reader->mapped ){
+    // There may be no room for the null after the end of the mapping
+    free( reader->last_line );
+    reader->last_line = (char *) malloc( length + 1 );
+    if ( reader->last_line == NULL ){
+      syserror( OUT_OF_MEMORY );
     }
+    memcpy( reader->last_line, reader->buffer + reader->start, length );
+    *line = reader->last_line;
   }
-  // nth pipe case a
-  else if ( (*_flags) == PIPE_CONTA ){
-    debug printf ( DEBUG_STRING_PIPE_CONTA );
-    switch ( pid = fork() ){
-      case -1:
-        syserror( FORK_FAIL );
-        break;
-      case  0:
-        // Stdin
-        if ( close( 0 ) == -1 ){
-          syserror( STDIN_CLOSE_ERROR );
-        }
-        dup(pfda[0]);
+  else{
+    *line = reader->buffer + reader->start;
+  }
+  (*line)[length] = '\0';
+  reader->start = reader->scanned = reader->length;
 
-        // Stdout
-        if ( close( 1 ) == -1 ){
-          syserror( STDOUT_CLOSE_ERROR );
-        }
-        dup(pfdb[1]);
+  return length;
+}
+///////////////////////////////////////////////////////////////////////////////
+void reader_release( struct reader* reader ){
+  // Puts the stdin offset at the next line for the children
+  if ( reader->shared ){
+    lseek( reader->fd, reader->start, SEEK_SET );
+  }
+}
+///////////////////////////////////////////////////////////////////////////////
+void reader_resume( struct reader* reader ){
+  // Skips anything the children read from stdin
+  off_t offset;
 
-        if ( close( pfda[0] ) == -1 || close( pfda[1] ) == -1 ||
-            close( pfdb[0] ) == -1 || close( pfdb[1] ) == -1 ){
-          syserror( PFD_CLOSE_ERROR );
-        }
+  if ( reader->shared ){
+    offset = lseek( reader->fd, 0, SEEK_CUR );
+    if ( offset > (off_t) reader->start ){
+      reader->start = reader->scanned =
+        (size_t) offset < reader->length ? (size_t) offset : reader->length;
+    }
+  }
+}
+///////////////////////////////////////////////////////////////////////////////
+void heredoc_read( struct command_list* list, struct reader* reader ){
+  // Fills in each here-document from the lines that follow
+  struct stage* stage;
+  struct redirect* redirect;
+  const char* delimiter;
+  char* line;
+  char* body;
+  size_t length, size, capacity, i;
+  ssize_t line_length;
+  bool found = false;
+  int j, k;
+  unsigned int r;
 
-        execvp( run_buffer_array[0], (char** ) run_buffer_array );
-        sprintf( concat_string_buffer, COMMAND_NOT_FOUND, run_buffer_array[0]);
-        syserror( concat_string_buffer );
-        break;
+  for( j = 0 ; j < list->count && !found ; j++ ){
+    for( k = 0 ; k < list->pipelines[j].count ; k++ ){
+      stage = &list->pipelines[j].stages[k];
+      for( r = 0 ; r < stage->redirect_count ; r++ ){
+        redirect = &stage->redirects[r];
+        found |= (redirect->type == REDIRECT_HEREDOC &&
+          !(redirect->source & HEREDOC_READ)) ||
+          ((redirect->type == REDIRECT_PROCESS_IN ||
+          redirect->type == REDIRECT_PROCESS_OUT) &&
+          strstr( redirect->file, "<<" ) != NULL);
+      }
     }
   }
-  // nth pipe case b
-  else if ( (*_flags) == PIPE_CONTB ){
-    debug printf ( DEBUG_STRING_PIPE_CONTB );
-    switch ( pid = fork() ){
-      case -1:
-        syserror( FORK_FAIL );
-        break;
-      case  0:
-        // Stdin
-        if ( close( 0 ) == -1 ){
-          syserror( STDIN_CLOSE_ERROR );
-        }
-        dup(pfdb[0]);
+  if ( !found ){
+    return;
+  }
 
-        // Stdout
-        if ( close( 1 ) == -1 ){
-          syserror( STDOUT_CLOSE_ERROR );
+  // The words still point into the line
+  for( j = 0 ; j < list->count ; j++ ){
+    for( k = 0 ; k < list->pipelines[j].count ; k++ ){
+      stage = &list->pipelines[j].stages[k];
+      for( i = 0 ; stage->run_buffer_array[i] != NULL ; i++ ){
+        stage->run_buffer_array[i] = arena_strndup( &list->arena,
+          stage->run_buffer_array[i], strlen( stage->run_buffer_array[i] ) );
+      }
+      for( i = 0 ; i < stage->assignment_count ; i++ ){
+        stage->assignments[i] = arena_strndup( &list->arena,
+          stage->assignments[i], strlen( stage->assignments[i] ) );
+      }
+      for( r = 0 ; r < stage->redirect_count ; r++ ){
+        if ( stage->redirects[r].file != NULL ){
+          stage->redirects[r].file = arena_strndup( &list->arena,
+            stage->redirects[r].file, strlen( stage->redirects[r].file ) );
         }
-        dup(pfda[1]);
+      }
+    }
+  }
 
-        if ( close( pfda[0] ) == -1 || close( pfda[1] ) == -1 ||
-            close( pfdb[0] ) == -1 || close( pfdb[1] ) == -1 ){
-          syserror( PFD_CLOSE_ERROR );
+  for( j = 0 ; j < list->count ; j++ ){
+    for( k = 0 ; k < list->pipelines[j].count ; k++ ){
+      stage = &list->pipelines[j].stages[k];
+      for( r = 0 ; r < stage->redirect_count ; r++ ){
+        redirect = &stage->redirects[r];
+
+        // Kept after the command, in the order they were written
+        if ( redirect->type == REDIRECT_PROCESS_IN ||
+            redirect->type == REDIRECT_PROCESS_OUT ){
+          body = heredoc_nested( redirect->file, reader, NULL );
+          if ( body != NULL ){
+            length = strlen( redirect->file );
+            line = (char *) arena_alloc( &list->arena,
+              length + strlen( body ) + 2 );
+            memcpy( line, redirect->file, length );
+            line[length] = '\n';
+            strcpy( line + length + 1, body );
+            redirect->file = line;
+            free( body );
+          }
+          continue;
         }
 
-        execvp( run_buffer_array[0], (char** ) run_buffer_array );
-        sprintf( concat_string_buffer, COMMAND_NOT_FOUND, run_buffer_array[0]);
-        syserror( concat_string_buffer );
-        break;
-    }
-  }
-  // last pipe case a
-  else if ( (*_flags) == PIPE_DRAINA ){
-    debug printf ( DEBUG_STRING_PIPE_DRAINA );
-    switch ( pid = fork() ){
-      case -1:
-        syserror( FORK_FAIL );
-        break;
-      case  0:
-        // Stdin
-        if ( close( 0 ) == -1 ){
-          syserror( STDIN_CLOSE_ERROR );
+        if ( redirect->type != REDIRECT_HEREDOC ||
+            redirect->source & HEREDOC_READ ){
+          continue;
         }
-        dup(pfda[0]);
+        delimiter = redirect->file;
+        length = strlen( delimiter );
+        body = NULL;
+        size = capacity = 0;
 
-        // Stdout
-        if ( io_pipe_array[1] != NULL ){
-          if ( close( 1 ) == -1 ){
-            syserror( STDOUT_CLOSE_ERROR );
+        while( 1 ){
+          if ( reader->interactive ){
+            printf( HEREDOC_PROMPT );
+            fflush( stdout );
           }
-          status = open(io_pipe_array[1], O_WRONLY | O_CREAT, 0644);
-          if ( status < 0 ){
-            syserror( STDOUT_OPEN_ERROR );
+          line_length = reader_getline( reader, &line );
+          if ( line_length == -1 ){
+            fprintf( stderr, HEREDOC_EOF, delimiter );
+            break;
+          }
+          if ( redirect->source & HEREDOC_TABS ){
+            while( line_length > 0 && *line == '\t' ){
+              line += 1;
+              line_length -= 1;
+            }
+          }
+          if ( ((size_t) line_length == length ||
+              ((size_t) line_length == length + 1 && line[length] == '\n')) &&
+              memcmp( line, delimiter, length ) == 0 ){
+            break;
+          }
+
+          if ( size + line_length + 1 > capacity ){
+            capacity = 2 * (size + line_length + 1);
+            body = (char *) realloc( body, capacity );
+            if ( body == NULL ){
+              syserror( OUT_OF_MEMORY );
+            }
+          }
+          if ( redirect->source & HEREDOC_QUOTED ){
+            memcpy( body + size, line, line_length );
+            size += line_length;
+            continue;
           }
-          dup(status);
-        }
 
-        if ( close( pfda[0] ) == -1 || close( pfda[1] ) == -1 ||
-            close( pfdb[0] ) == -1 || close( pfdb[1] ) == -1 ){
-          syserror( PFD_CLOSE_ERROR );
+          // As inside double quotes, and a \ before the newline joins lines
+          for( i = 0 ; i < (size_t) line_length ; i++ ){
+            if ( line[i] == '\\' && (line[i+1] == '$' ||
+                line[i+1] == '\\' || line[i+1] == '`') ){
+              body[size++] = line[++i];
+            }
+            else if ( line[i] == '\\' && line[i+1] == '\n' ){
+              i += 1;
+            }
+            else{
+              body[size++] = line[i] == '$' ? EXPAND_QUOTED : line[i];
+            }
+          }
         }
 
-        execvp( run_buffer_array[0], (char** ) run_buffer_array );
-        sprintf( concat_string_buffer, COMMAND_NOT_FOUND, run_buffer_array[0]);
-        syserror( concat_string_buffer );
-        break;
+        redirect->file = arena_strndup( &list->arena, body ? body : "",
+          size );
+        redirect->source = HEREDOC_READ;
+        free( body );
+      }
     }
   }
-  // last pipe case b
-  else if ( (*_flags) == PIPE_DRAINB ){
-    debug printf ( DEBUG_STRING_PIPE_DRAINB );
-    switch ( pid = fork() ){
-      case -1:
-        syserror( FORK_FAIL );
-        break;
-      case  0:
-        // Stdin
-        if ( close( 0 ) == -1 )
-          syserror( STDIN_CLOSE_ERROR );
-        dup(pfdb[0]);
-
-        // Stdout
-        if ( io_pipe_array[1] != NULL ){
-          if ( close( 1 ) == -1 ){
-            syserror( STDOUT_CLOSE_ERROR );
-          }
-          status = open(io_pipe_array[1], O_WRONLY | O_CREAT, 0644);
-          if ( status < 0 ){
-            syserror( STDOUT_OPEN_ERROR );
-          }
-          dup(status);
+}
+///////////////////////////////////////////////////////////////////////////////
+char* heredoc_nested( const char* command, struct reader* reader,
+    char* lines ){
+  // Reads the raw lines for the here-documents a command will read itself
+  struct command_list list;
+  struct redirect* redirect;
+  struct stage* stage;
+  char* copy;
+  char* line;
+  char* start;
+  size_t length, size;
+  ssize_t line_length;
+  int j, k;
+  unsigned int r;
+
+  if ( strstr( command, "<<" ) == NULL ){
+    return lines;
+  }
+
+  // A copy is cut up, errors are left for when it runs
+  memset( &list, 0, sizeof(list) );
+  copy = strdup( command );
+  if ( copy == NULL ){
+    syserror( OUT_OF_MEMORY );
+  }
+  list.quiet = true;
+  if ( !parse_line( copy, &list ) ){
+    list.count = 0;
+  }
+
+  size = lines != NULL ? strlen( lines ) : 0;
+  for( j = 0 ; j < list.count ; j++ ){
+    for( k = 0 ; k < list.pipelines[j].count ; k++ ){
+      stage = &list.pipelines[j].stages[k];
+      for( r = 0 ; r < stage->redirect_count ; r++ ){
+        redirect = &stage->redirects[r];
+        if ( redirect->type == REDIRECT_PROCESS_IN ||
+            redirect->type == REDIRECT_PROCESS_OUT ){
+          lines = heredoc_nested( redirect->file, reader, lines );
+          size = lines != NULL ? strlen( lines ) : 0;
+          continue;
         }
-        if ( close( pfda[0] ) == -1 || close( pfda[1] ) == -1 ||
-            close( pfdb[0] ) == -1 || close( pfdb[1] ) == -1 ){
-          syserror( PFD_CLOSE_ERROR );
+        if ( redirect->type != REDIRECT_HEREDOC ){
+          continue;
         }
 
-        execvp( run_buffer_array[0], (char** ) run_buffer_array );
-        sprintf( concat_string_buffer, COMMAND_NOT_FOUND, run_buffer_array[0]);
-        syserror( concat_string_buffer );
-        break;
-    }
-  }
+        length = strlen( redirect->file );
+        while( 1 ){
+          if ( reader->interactive ){
+            printf( HEREDOC_PROMPT );
+            fflush( stdout );
+          }
+          line_length = reader_getline( reader, &line );
+          if ( line_length == -1 ){
+            break;
+          }
+          lines = (char *) realloc( lines, size + line_length + 1 );
+          if ( lines == NULL ){
+            syserror( OUT_OF_MEMORY );
+          }
+          memcpy( lines + size, line, line_length );
+          size += line_length;
+          lines[size] = '\0';
 
-  // Close the used pipe from the parent
-  if ( (*_flags) == PIPE_DRAINA || (*_flags) == PIPE_CONTA ){
-    if ( close(pfda[0]) == -1 || close(pfda[1]) == -1 ){
-      syserror( PFD_A_CLOSE_FAIL );
+          start = line;
+          if ( redirect->source & HEREDOC_TABS ){
+            while( line_length > 0 && *start == '\t' ){
+              start += 1;
+              line_length -= 1;
+            }
+          }
+          if ( ((size_t) line_length == length ||
+              ((size_t) line_length == length + 1 &&
+              start[length] == '\n')) &&
+              memcmp( start, redirect->file, length ) == 0 ){
+            break;
+          }
+        }
+      }
     }
   }
-  else if ( (*_flags) == PIPE_DRAINB || (*_flags) == PIPE_CONTB ){
-    if ( close(pfdb[0]) == -1 || close(pfdb[1]) == -1 ){
-      syserror( PFD_B_CLOSE_FAIL );
-    }
+
+  command_list_free( &list );
+  free( copy );
+  return lines;
 }
+///////////////////////////////////////////////////////////////////////////////
+bool parse_text( char* text, struct command_list* list ){
+  // Parses a line that carries its here-document lines after it
+  struct reader reader;
+  char* newline;
 
-  // Parent Waiting
-  while ( (pid = wait( (int *) 0 ) ) != -1 )
-    ;
+  memset( &reader, 0, sizeof(reader) );
+  reader.fd = -1;
+  reader.eof = true;
 
-  // Switch pipe states and make a new pipe
-  if ( (*_flags) == PIPE_START ){
-    (*_flags) = PIPE_CONTA;
+  // Copied out first, as the tokenizer writes over the end of the line
+  newline = strchr( text, '\n' );
+  if ( newline != NULL ){
+    reader.buffer = strdup( newline + 1 );
+    if ( reader.buffer == NULL ){
+      syserror( OUT_OF_MEMORY );
+    }
+    reader.length = strlen( reader.buffer );
+    reader.capacity = reader.length + 1;
   }
-  else if ( (*_flags) == PIPE_CONTA ){
-    (*_flags) = PIPE_CONTB;
-    if ( pipe(pfda) == -1 )
-      syserror( PFD_OPEN_ERROR );
+
+  if ( !parse_line( text, list ) ){
+    reader_close( &reader );
+    return false;
   }
-  else if ( (*_flags) == PIPE_CONTB ){
-    (*_flags) = PIPE_CONTA;
-    if ( pipe(pfdb) == -1 )
-      syserror( PFD_OPEN_ERROR );
+  heredoc_read( list, &reader );
+  reader_close( &reader );
+  return true;
+}
+///////////////////////////////////////////////////////////////////////////////
+void reader_close( struct reader* reader ){
+  // Releases the buffer and the script file
+  if ( reader->mapped ){
+    munmap( reader->buffer, reader->length );
   }
-  else if ( (*_flags) == PIPE_DRAINA){
-    (*_flags) = NO_PIPE;
-    if ( pipe(pfda) == -1 )
-      syserror( PFD_OPEN_ERROR );
+  else{
+    free( reader->buffer );
   }
-  else if ( (*_flags) == PIPE_DRAINB){
-    (*_flags) = NO_PIPE;
-    if ( pipe(pfdb) == -1 )
-      syserror( PFD_OPEN_ERROR );
+  free( reader->last_line );
+  if ( reader->fd != 0 ){
+    close( reader->fd );
   }
-
-  free_run_array(run_buffer_array, ARG_COUNT);
-  free_run_array(io_pipe_array,2);
-  debug printf( DEBUG_STRING_FORK_END );
-}
-///////////////////////////////////////////////////////////////////////////////
-void syserror(const char *s){
-  // System error call
-  extern int errno;
-
-  fprintf( stderr, "%s\n", s );
-  fprintf( stderr, " (%s)\n", strerror(errno) );
-  exit( 1 );
 }
 ///////////////////////////////////////////////////////////////////////////////
-int command_out( char* input_buffer, int previous_end,
-    int current_pos, bool *is_command, char* run_buffer_array[],
-    unsigned int* args ){
-  // Parses the input string and adds it into the cmd array
-  static unsigned int args_count = 0;
+int script_cache_open( struct script_cache* cache, const char* script,
+    struct reader* reader ){
+  // Maps the script's table if it is current, otherwise builds it
+  struct stat info;
+  char* path;
+  uint64_t hash;
+  size_t i;
+  int status;
 
-  debug_verbose printf(
-    DEBUG_STRING_COMMAND_OUT_CALL, previous_end, current_pos );
-
-  if ( *is_command ){
-    debug_verbose printf( DEBUG_STRING_CUR_CMD );
-    // free_run_array(run_buffer_array, ARG_COUNT);
-    args_count = 0;
-    run_buffer_array[args_count] = (char *) malloc(current_pos-previous_end-1);
-
-    strncpy(run_buffer_array[args_count],
-        input_buffer+previous_end+1, current_pos-previous_end-1);
-    run_buffer_array[args_count][current_pos-previous_end-1] = '\0';
-    *is_command = false;
+  if ( !reader->mapped || fstat( reader->fd, &info ) == -1 ){
+    return -1;
   }
-  else{
-    args_count+=1;
-    debug_verbose printf( DEBUG_STRING_CUR_ARG, args_count );
 
-    run_buffer_array[args_count] = (char *) malloc(current_pos-previous_end-1);
-
-    strncpy(run_buffer_array[args_count],
-        input_buffer+previous_end+1, current_pos-previous_end-1 );
-    run_buffer_array[args_count][current_pos-previous_end-1] = '\0';
+  // FNV-1a over the text, far cheaper than cutting it up
+  hash = 14695981039346656037ULL;
+  for( i = 0 ; i < reader->length ; i++ ){
+    hash = (hash ^ (unsigned char) reader->buffer[i]) * 1099511628211ULL;
   }
 
-  *args = args_count;
+  memset( cache, 0, sizeof(struct script_cache) );
+  memcpy( cache->header.magic, CACHE_MAGIC, 4 );
+  cache->header.version = CACHE_VERSION;
+  cache->header.script_size = info.st_size;
+  cache->header.script_mtime = info.st_mtim.tv_sec;
+  cache->header.script_mtime_nsec = info.st_mtim.tv_nsec;
+  cache->header.script_hash = hash;
 
-  return current_pos;
-}
-///////////////////////////////////////////////////////////////////////////////
-int modify_fin_fout( char* input_buffer, int previous_end,
-    int current_pos, bool mode, char* io_pipe_array[]){
-  // Adds the file name, due to a pipe character in front,
-  // into the cmd array
+  path = (char *) malloc( strlen( script ) + sizeof(CACHE_SUFFIX) );
+  if ( path == NULL ){
+    syserror( OUT_OF_MEMORY );
+  }
+  strcpy( stpcpy( path, script ), CACHE_SUFFIX );
 
-  if ( mode ){
-    io_pipe_array[0] = (char *) malloc(current_pos-previous_end);
-    strncpy(io_pipe_array[0], // Input File
-        input_buffer+previous_end+1, current_pos-previous_end);
-    io_pipe_array[0][current_pos-previous_end-1] = '\0';
+  status = script_cache_load( cache, path );
+  if ( status == 0 && script_cache_link( cache ) == -1 ){
+    script_cache_close( cache );
+    status = -1;
   }
-  else{
-    io_pipe_array[1] = (char *) malloc(current_pos-previous_end);
-    strncpy(io_pipe_array[1], // Output File
-        input_buffer+previous_end+1, current_pos-previous_end);
-    io_pipe_array[1][current_pos-previous_end-1] = '\0';
+  trace( TRACE_CACHE, 0, path, status == 0 );
+
+  if ( status == -1 ){
+    // Built here and only written out if that is possible
+    script_cache_compile( cache, reader );
+    if ( script_cache_link( cache ) == -1 ){
+      syserror( OUT_OF_MEMORY );
+    }
+    script_cache_write( cache, path );
   }
 
-  return current_pos;
+  free( path );
+  return 0;
 }
 ///////////////////////////////////////////////////////////////////////////////
-void check_ctrl_d( char* input_buffer, int length ){
-  // Checks for Ctrl+D in the input
-  static int i;
+void script_cache_run( struct script_cache* cache,
+    struct command_list* list ){
+  // Runs the lines of the table as the shell loop would
+  struct cache_record* record;
+  uint32_t index = 0;
 
-  for( i = 0 ; i < length ; i++ ){
-    if ( !input_buffer[i] ){
-      debug printf ( DEBUG_STRING_CONTAIN_CTRL_D );
-      exit( 0 );
+  while( index < cache->header.record_count ){
+    jobs_update();
+    jobs_notify();
+
+    record = &cache->records[index];
+    if ( record->type == CACHE_RAW ){
+      index += 1;
+      if ( !parse_line( cache->strings + record->offset, list ) ){
+        command_list_clear( list );
+        executor.status = 2;
+        continue;
+      }
     }
-    if ( input_buffer[i] == '\n' ){
-      debug printf( DEBUG_STRING_NO_CONTAIN_CTRL_D );
-      break;
+    else{
+      index = script_cache_fill( cache, index, list );
     }
+
+    proc_command_list( list );
   }
 }
 ///////////////////////////////////////////////////////////////////////////////
-void purge_string( char* buffer, int length ){
-  // Empties the string
-  static int i;
+uint32_t script_cache_fill( struct script_cache* cache, uint32_t index,
+    struct command_list* list ){
+  // Rebuilds the pipelines of a line from its records
+  struct cache_record* line;
+  struct cache_record* record;
+  struct pipeline* pipeline;
+  struct stage* stage;
+  struct redirect* redirect;
+  uint32_t i, j, k;
 
-  for( i = 0 ; i < length ; i++ ){
-    buffer[i] = '\0';
+  line = &cache->records[index++];
+  for( i = 0 ; i < line->count ; i++ ){
+    record = &cache->records[index++];
+    pipeline = command_list_add_pipeline( list );
+    pipeline->background = record->flags & CACHE_BACKGROUND;
+    pipeline->timed = record->flags & CACHE_TIMED;
+    pipeline->run_if = record->flags & CACHE_ON_SUCCESS ? RUN_ON_SUCCESS :
+      record->flags & CACHE_ON_FAILURE ? RUN_ON_FAILURE : RUN_ALWAYS;
+    pipeline->pipe_size = record->offset;
+    pipeline->parse_time = 0;
+
+    for( j = record->count ; j > 0 ; j-- ){
+      record = &cache->records[index++];
+      stage = pipeline_add_stage( pipeline, &list->arena );
+      stage->assignments = cache->argv_pointers + record->offset;
+      stage->assignment_count = stage->assignment_capacity =
+        record->assignments;
+      stage->run_buffer_array = cache->argv_pointers + record->offset +
+        record->assignments;
+      stage->args_capacity = record->count + 1;
+      stage->args_count = record->count ? record->count - 1 : 0;
+      stage->args_size = record->args_size;
+      for( k = record->redirects ; k > 0 ; k-- ){
+        record = &cache->records[index++];
+        redirect = stage_add_redirect( stage, &list->arena );
+        redirect->type = (enum redirect_type) record->flags;
+        redirect->fd = record->fd;
+        redirect->source = record->source;
+        redirect->file = record->offset == CACHE_NONE ? NULL :
+          cache->strings + record->offset;
+      }
+    }
   }
+
+  return index;
 }
 ///////////////////////////////////////////////////////////////////////////////
-char remove_whitespace( char* input_buffer, int* previous_end,
-    int* current_pos){
-  // Filters leading whitespace for the next string
+void script_cache_compile( struct script_cache* cache,
+    struct reader* reader ){
+  // Parses the whole script once
+  struct command_list list;
+  struct cache_record* record;
+  ssize_t length;
+  uint32_t raw;
+  char* line;
 
-  static char current_char;
+  memset( &list, 0, sizeof(list) );
+  list.quiet = true;
 
-  if ( (current_char = input_buffer[*current_pos]) == ' ' ){
-    do{
-      debug_verbose printf( DEBUG_STRING_REMOVING_WHITESPACE );
-      (*current_pos) +=1;
-      (*previous_end) +=1;
-    } while ( (current_char = input_buffer[*current_pos]) == ' ' );
+  while( (length = reader_getline( reader, &line )) != -1 ){
+    if ( line[0] == '\n' ){
+      continue;
+    }
+
+    // The text is kept before the parse cuts it up, and dropped if the
+    // line parses
+    raw = script_cache_string( cache, line,
+      line[length-1] == '\n' ? length - 1 : length );
+    if ( parse_line( line, &list ) ){
+      cache->header.strings_size = raw;
+      heredoc_read( &list, reader );
+      script_cache_add_line( cache, &list );
+    }
+    else{
+      cache->records = (struct cache_record *) script_cache_grow(
+        cache->records, &cache->record_capacity,
+        cache->header.record_count + 1, sizeof(struct cache_record) );
+      record = &cache->records[cache->header.record_count++];
+      memset( record, 0, sizeof(struct cache_record) );
+      record->type = CACHE_RAW;
+      record->offset = raw;
+    }
+    command_list_clear( &list );
   }
 
-  return current_char;
+  command_list_free( &list );
 }
 ///////////////////////////////////////////////////////////////////////////////
-void free_run_array(char * run_buffer_array[], int size){
-  // Frees every element of a char* [] and then sets them to null
-  static int i;
+void script_cache_add_line( struct script_cache* cache,
+    struct command_list* list ){
+  // Flattens a line into line, pipeline and stage records
+  struct cache_record* record;
+  struct pipeline* pipeline;
+  struct stage* stage;
+  struct redirect* redirect;
+  uint32_t count, words;
+  int i, j, k;
 
-  for( i = 0 ; i < size ; i++ ){
-    free(run_buffer_array[i]);
-    run_buffer_array[i] = NULL;
+  count = 1;
+  for( i = 0 ; i < list->count ; i++ ){
+    count += 1 + list->pipelines[i].count;
+    for( j = 0 ; j < list->pipelines[i].count ; j++ ){
+      count += list->pipelines[i].stages[j].redirect_count;
+    }
+  }
+  cache->records = (struct cache_record *) script_cache_grow(
+    cache->records, &cache->record_capacity,
+    cache->header.record_count + count, sizeof(struct cache_record) );
+
+  record = &cache->records[cache->header.record_count++];
+  memset( record, 0, sizeof(struct cache_record) );
+  record->type = CACHE_LINE;
+  record->count = list->count;
+
+  for( i = 0 ; i < list->count ; i++ ){
+    pipeline = &list->pipelines[i];
+    record = &cache->records[cache->header.record_count++];
+    memset( record, 0, sizeof(struct cache_record) );
+    record->type = CACHE_PIPELINE;
+    record->count = pipeline->count;
+    record->offset = pipeline->pipe_size;
+    record->flags = (pipeline->background ? CACHE_BACKGROUND : 0) |
+      (pipeline->timed ? CACHE_TIMED : 0) |
+      (pipeline->run_if == RUN_ON_SUCCESS ? CACHE_ON_SUCCESS : 0) |
+      (pipeline->run_if == RUN_ON_FAILURE ? CACHE_ON_FAILURE : 0);
+
+    for( j = 0 ; j < pipeline->count ; j++ ){
+      stage = &pipeline->stages[j];
+      words = stage->run_buffer_array[0] ? stage->args_count + 1 : 0;
+
+      record = &cache->records[cache->header.record_count++];
+      memset( record, 0, sizeof(struct cache_record) );
+      record->type = CACHE_STAGE;
+      record->count = words;
+      record->offset = cache->header.argv_count;
+      record->redirects = stage->redirect_count;
+      record->assignments = stage->assignment_count;
+      record->args_size = stage->args_size;
+      for( k = 0 ; k < (int) stage->redirect_count ; k++ ){
+        redirect = &stage->redirects[k];
+        record = &cache->records[cache->header.record_count++];
+        memset( record, 0, sizeof(struct cache_record) );
+        record->type = CACHE_REDIRECT;
+        record->offset = redirect->file == NULL ? CACHE_NONE :
+          script_cache_string( cache, redirect->file,
+            strlen( redirect->file ) );
+        record->fd = redirect->fd;
+        record->source = redirect->type == REDIRECT_DUP ?
+          redirect->source : 0;
+        record->flags = redirect->type;
+      }
+
+      cache->argv = (uint32_t *) script_cache_grow( cache->argv,
+        &cache->argv_capacity, cache->header.argv_count +
+          stage->assignment_count + words + 1, sizeof(uint32_t) );
+      for( k = 0 ; k < (int) stage->assignment_count ; k++ ){
+        cache->argv[cache->header.argv_count++] = script_cache_string(
+          cache, stage->assignments[k], strlen( stage->assignments[k] ) );
+      }
+      for( k = 0 ; k < (int) words ; k++ ){
+        cache->argv[cache->header.argv_count++] = script_cache_string(
+          cache, stage->run_buffer_array[k],
+          strlen( stage->run_buffer_array[k] ) );
+      }
+      cache->argv[cache->header.argv_count++] = CACHE_NONE;
+    }
   }
 }
 ///////////////////////////////////////////////////////////////////////////////
-void null_run_array(char * run_buffer_array[], int size){
-  // Sets every element of a char* array to null
-  static int i;
+uint32_t script_cache_string( struct script_cache* cache, const char* string,
+    size_t length ){
+  // Copies a string to the end of the strings
+  uint32_t offset = cache->header.strings_size;
 
-  for( i = 0 ; i < size ; i++ ){
-    run_buffer_array[i] = NULL;
-  }
+  cache->strings = (char *) script_cache_grow( cache->strings,
+    &cache->strings_capacity, offset + length + 1, 1 );
+  memcpy( cache->strings + offset, string, length );
+  cache->strings[offset + length] = '\0';
+  cache->header.strings_size += length + 1;
+
+  return offset;
 }
 ///////////////////////////////////////////////////////////////////////////////
-void show_io( char* io_pipe_array[]){
-  // Prints the value in the io pipe array
-  printf( INPUT_FILE, io_pipe_array[0]);
-  printf( OUTPUT_FILE, io_pipe_array[1]);
+void* script_cache_grow( void* array, uint32_t* capacity, uint32_t needed,
+    size_t size ){
+  // Doubles the array until it fits
+  if ( needed <= *capacity ){
+    return array;
+  }
+  while( *capacity < needed ){
+    *capacity = *capacity ? *capacity * 2 : 256;
+  }
+  array = realloc( array, (size_t) *capacity * size );
+  if ( array == NULL ){
+    syserror( OUT_OF_MEMORY );
+  }
+  return array;
 }
 ///////////////////////////////////////////////////////////////////////////////
-void show_state( char* run_buffer_array[], int args_count ){
-  // Prints everything in the cmd array
-  static int i;
+int script_cache_load( struct script_cache* cache, const char* path ){
+  // Maps the cache file if it was made from this version of the script
+  struct cache_header* header;
+  struct stat info;
+  char* data;
+  int fd;
+
+  fd = open( path, O_RDONLY | O_CLOEXEC );
+  if ( fd == -1 ){
+    return -1;
+  }
+  if ( fstat( fd, &info ) == -1 ||
+      (size_t) info.st_size < sizeof(struct cache_header) ){
+    close( fd );
+    return -1;
+  }
+
+  // Private and writable, a builtin may write into its arguments
+  data = (char *) mmap( NULL, info.st_size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE, fd, 0 );
+  close( fd );
+  if ( data == MAP_FAILED ){
+    return -1;
+  }
+
+  // Everything up to the sizes is the key
+  header = (struct cache_header *) data;
+  if ( memcmp( header, &cache->header,
+        offsetof( struct cache_header, record_count ) ) != 0 ||
+      (size_t) info.st_size != sizeof(struct cache_header) +
+        (size_t) header->record_count * sizeof(struct cache_record) +
+        (size_t) header->argv_count * sizeof(uint32_t) +
+        header->strings_size ){
+    munmap( data, info.st_size );
+    return -1;
+  }
+
+  cache->header = *header;
+  cache->records = (struct cache_record *) (header + 1);
+  cache->argv = (uint32_t *) (cache->records + header->record_count);
+  cache->strings = (char *) (cache->argv + header->argv_count);
+  cache->mapping = data;
+  cache->mapping_size = info.st_size;
 
-  printf( COMMAND , run_buffer_array[0] );
-  for( i = 0 ; i < args_count ; i++ ){
-    printf( ARGUMENT , i, run_buffer_array[1+i] );
+  return 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+int script_cache_write( struct script_cache* cache, const char* path ){
+  // Writes the table beside the script, all or nothing
+  struct iovec parts[4];
+  char* temporary;
+  ssize_t total;
+  mode_t mask;
+  int fd, i;
+
+  temporary = (char *) malloc( strlen( path ) + 8 );
+  if ( temporary == NULL ){
+    syserror( OUT_OF_MEMORY );
+  }
+  strcpy( stpcpy( temporary, path ), ".XXXXXX" );
+
+  fd = mkostemp( temporary, O_CLOEXEC );
+  if ( fd == -1 ){
+    free( temporary );
+    return -1;
+  }
+
+  parts[0].iov_base = &cache->header;
+  parts[0].iov_len = sizeof(struct cache_header);
+  parts[1].iov_base = cache->records;
+  parts[1].iov_len = cache->header.record_count * sizeof(struct cache_record);
+  parts[2].iov_base = cache->argv;
+  parts[2].iov_len = cache->header.argv_count * sizeof(uint32_t);
+  parts[3].iov_base = cache->strings;
+  parts[3].iov_len = cache->header.strings_size;
+
+  total = 0;
+  for( i = 0 ; i < 4 ; i++ ){
+    total += parts[i].iov_len;
+  }
+
+  // mkostemp makes it 0600, the shell's other files are 0644 less the umask
+  mask = umask( 0 );
+  umask( mask );
+
+  if ( writev( fd, parts, 4 ) != total || fchmod( fd, 0644 & ~mask ) == -1 ||
+      close( fd ) == -1 || rename( temporary, path ) == -1 ){
+    unlink( temporary );
+    free( temporary );
+    return -1;
+  }
+
+  free( temporary );
+  return 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+int script_cache_link( struct script_cache* cache ){
+  // Checks the table and makes the argv pointers
+  struct cache_record* record;
+  uint32_t index, lines, pipelines, stages, i, j, k;
+
+  if ( cache->header.strings_size > 0 &&
+      cache->strings[cache->header.strings_size - 1] != '\0' ){
+    return -1;
+  }
+
+  cache->argv_pointers = (char **) malloc(
+    (cache->header.argv_count + 1) * sizeof(char *) );
+  if ( cache->argv_pointers == NULL ){
+    syserror( OUT_OF_MEMORY );
+  }
+  for( i = 0 ; i < cache->header.argv_count ; i++ ){
+    if ( cache->argv[i] == CACHE_NONE ){
+      cache->argv_pointers[i] = NULL;
+    }
+    else if ( cache->argv[i] < cache->header.strings_size ){
+      cache->argv_pointers[i] = cache->strings + cache->argv[i];
+    }
+    else{
+      return -1;
+    }
+  }
+
+  // Each line must hold the pipelines and stages it says it does
+  lines = cache->header.record_count;
+  for( index = 0 ; index < lines ; ){
+    record = &cache->records[index++];
+    if ( record->type == CACHE_RAW ){
+      if ( record->offset >= cache->header.strings_size ){
+        return -1;
+      }
+      continue;
+    }
+    if ( record->type != CACHE_LINE ){
+      return -1;
+    }
+    for( pipelines = record->count ; pipelines > 0 ; pipelines-- ){
+      if ( index >= lines ||
+          cache->records[index].type != CACHE_PIPELINE ||
+          cache->records[index].count == 0 ){
+        return -1;
+      }
+      stages = cache->records[index++].count;
+      for( j = 0 ; j < stages ; j++ ){
+        if ( index >= lines ){
+          return -1;
+        }
+        record = &cache->records[index++];
+        if ( record->type != CACHE_STAGE ||
+            (uint64_t) record->offset + record->assignments +
+              record->count >= cache->header.argv_count ||
+            cache->argv[record->offset + record->assignments +
+              record->count] != CACHE_NONE ){
+          return -1;
+        }
+        for( k = 0 ; k < record->assignments ; k++ ){
+          if ( cache->argv[record->offset + k] == CACHE_NONE ){
+            return -1;
+          }
+        }
+        for( k = record->redirects ; k > 0 ; k-- ){
+          if ( index >= lines ){
+            return -1;
+          }
+          record = &cache->records[index++];
+          if ( record->type != CACHE_REDIRECT ||
+              record->flags > REDIRECT_PROCESS_OUT ||
+              record->fd > INT_MAX || record->source > INT_MAX ||
+              (record->flags == REDIRECT_DUP) !=
+                (record->offset == CACHE_NONE) ||
+              (record->offset != CACHE_NONE &&
+                record->offset >= cache->header.strings_size) ){
+            return -1;
+          }
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+void script_cache_close( struct script_cache* cache ){
+  // Releases the table however it was made
+  if ( cache->mapping != NULL ){
+    munmap( cache->mapping, cache->mapping_size );
+  }
+  else{
+    free( cache->records );
+    free( cache->argv );
+    free( cache->strings );
+  }
+  free( cache->argv_pointers );
+  memset( cache, 0, sizeof(struct script_cache) );
+}
+///////////////////////////////////////////////////////////////////////////////
+void proc_command_list( struct command_list* list ){
+  // Runs each pipeline of the line in turn
+  struct pipeline* pipeline;
+  bool stats;
+  int i;
+
+  // The stats mode times every pipeline as if it started with time
+  stats = variable_value( STATS_ENV ) != NULL;
+  executor.pipefail = variable_value( PIPEFAIL_ENV ) != NULL;
+
+  for( i = 0 ; i < list->count ; i++ ){
+    pipeline = &list->pipelines[i];
+    pipeline->timed |= stats;
+
+    // Nothing after the last & or ;, or a line of only spaces
+    if ( pipeline->count == 1 && stage_empty( &pipeline->stages[0] ) ){
+      continue;
+    }
+
+    // && and || go by the status of the last pipeline that ran
+    if ( (pipeline->run_if == RUN_ON_SUCCESS && executor.status != 0) ||
+        (pipeline->run_if == RUN_ON_FAILURE && executor.status == 0) ){
+      trace( TRACE_SKIP, 0, NULL, i );
+      continue;
+    }
+
+    executor.status = proc_pipeline( pipeline, &list->arena );
+    trace( TRACE_STATUS, 0, NULL, executor.status );
+  }
+
+  command_list_clear( list );
+}
+///////////////////////////////////////////////////////////////////////////////
+int proc_pipeline( struct pipeline* pipeline, struct arena* arena ){
+  // Starts every stage of the pipeline and then reaps them together
+
+  struct job_process* processes;
+  struct stage* stage;
+  struct job* job;
+  struct rusage before;
+  int i;
+
+  if ( pipeline->timed ){
+    clock_gettime( CLOCK_MONOTONIC, &pipeline->start );
+  }
+  pipeline_expand( pipeline, arena );
+
+  // Assignments without a command set the shell's own variables
+  stage = &pipeline->stages[0];
+  if ( pipeline->count == 1 && stage->run_buffer_array[0] == NULL &&
+      stage->assignment_count > 0 ){
+    for( i = 0 ; i < (int) stage->assignment_count ; i++ ){
+      variable_assign( stage->assignments[i], false );
+    }
+    if ( stage_open_files( stage ) == -1 ){
+      return 1;
+    }
+    stage_close_files( stage );
+
+    // So setting WORKERS_ENV takes effect at once
+    pool_refill();
+    return 0;
+  }
+
+  // A pipeline that is one builtin runs in the shell without forking
+  if ( pipeline->count == 1 && !pipeline->background &&
+      stage->run_buffer_array[0] != NULL &&
+      (stage->builtin = builtin_lookup( stage->run_buffer_array[0] ))
+      != NULL ){
+    if ( !pipeline->timed ){
+      return proc_builtin( stage );
+    }
+
+    // Timed as the shell's own usage over the call
+    processes = (struct job_process *) arena_alloc( arena,
+      sizeof(struct job_process) );
+    stage->start = pipeline->spawned = pipeline->start;
+    getrusage( RUSAGE_SELF, &before );
+    processes->status = W_EXITCODE( proc_builtin( stage ), 0 );
+    getrusage( RUSAGE_SELF, &processes->usage );
+    clock_gettime( CLOCK_MONOTONIC, &processes->end );
+    processes->pid = 0;
+    processes->state = PROCESS_DONE;
+    rusage_subtract( &processes->usage, &before );
+    time_report( pipeline, processes );
+    return job_exit_status( processes, 1 );
+  }
+
+  if ( pipeline_start( pipeline ) == -1 ){
+    return 1;
+  }
+  if ( pipeline->timed ){
+    clock_gettime( CLOCK_MONOTONIC, &pipeline->spawned );
+  }
+
+  // A background pipeline goes in the job table and is reaped later
+  if ( pipeline->background ){
+    job = job_add( pipeline );
+    if ( job != NULL && executor.job_table.job_control ){
+      printf( JOB_STARTED, job->id, job->processes[job->count-1].pid );
+    }
+    return 0;
+  }
+
+  // Parent Waiting, the pipeline only becomes a job if it is stopped.
+  // A stage that never started failed as sh would report it.
+  processes = (struct job_process *) arena_alloc( arena,
+    pipeline->count * sizeof(struct job_process) );
+  for( i = 0 ; i < pipeline->count ; i++ ){
+    stage = &pipeline->stages[i];
+    processes[i].pid = stage->pid;
+    processes[i].status = 0;
+    processes[i].state = PROCESS_RUNNING;
+    if ( stage->pid == -1 ){
+      processes[i].status = W_EXITCODE(
+        stage->builtin == NULL && stage->path == NULL ? 127 : 1, 0 );
+      processes[i].state = PROCESS_DONE;
+    }
+  }
+
+  if ( job_wait( processes, pipeline->count, pipeline->pgid, true ) ==
+      PROCESS_DONE ){
+    if ( pipeline->timed ){
+      time_report( pipeline, processes );
+    }
+    return job_exit_status( processes, pipeline->count );
+  }
+
+  job = job_add( pipeline );
+  if ( job != NULL ){
+    memcpy( job->processes, processes,
+      pipeline->count * sizeof(struct job_process) );
+    printf( JOB_ENTRY, job->id, '+', JOB_STOPPED_STRING, job->command );
+  }
+  return 128 + SIGTSTP;
+}
+///////////////////////////////////////////////////////////////////////////////
+int pipeline_start( struct pipeline* pipeline ){
+  // Wires up every stage and forks them all, without waiting
+
+  struct stage* stage;
+  const char* env;
+  size_t pipe_size;
+  int pfd[2];
+  int i;
+
+  // Nothing can be forked if a stage is missing its command
+  for( i = 0 ; i < pipeline->count ; i++ ){
+    if ( pipeline->stages[i].run_buffer_array[0] == NULL ){
+      printf( UNEXPECTED_EOL );
+      return -1;
+    }
+  }
+
+  // Builtins are looked up before anything else, they run in a child
+  for( i = 0 ; i < pipeline->count ; i++ ){
+    stage = &pipeline->stages[i];
+    stage->builtin = builtin_lookup( stage->run_buffer_array[0] );
+  }
+
+  // Refuse what execve would, before anything is forked
+  if ( executor.arg_max == 0 ){
+    executor.arg_max = sysconf( _SC_ARG_MAX );
+  }
+  for( i = 0 ; i < pipeline->count ; i++ ){
+    if ( executor.arg_max > 0 &&
+        pipeline->stages[i].args_size > (size_t) executor.arg_max ){
+      fprintf( stderr, ARGUMENT_LIST_TOO_LONG,
+        pipeline->stages[i].run_buffer_array[0] );
+      return -1;
+    }
+  }
+
+  // Bigger pipes mean fewer wakeups between a fast writer and reader
+  pipe_size = pipeline->pipe_size;
+  if ( pipe_size == 0 && pipeline->count > 1 &&
+      (env = variable_value( PIPE_SIZE_ENV )) != NULL && env[0] != '\0' ){
+    pipe_size = parse_size( env );
+    if ( pipe_size == 0 ){
+      fprintf( stderr, PIPE_SIZE_INVALID, PIPE_SIZE_ENV );
+    }
+  }
+
+  // One pass over the stages hands each its stdin and stdout
+  for( i = 0 ; i < pipeline->count ; i++ ){
+    stage = &pipeline->stages[i];
+    if ( i == 0 ){
+      stage->fd[0] = 0;
+    }
+    if ( i == pipeline->count - 1 ){
+      stage->fd[1] = pipeline->out_fd;
+    }
+    else{
+      // Close on exec, the children only keep the ends moved onto 0 and 1
+      if ( pipe2(pfd, O_CLOEXEC) == -1 ){
+        syserror( PFD_OPEN_ERROR );
+      }
+      if ( pipe_size > 0 && pipe_size <= INT_MAX &&
+          fcntl( pfd[1], F_SETPIPE_SZ, (int) pipe_size ) == -1 ){
+        // Over pipe-max-size, the pipes keep the size they have
+        fprintf( stderr, PIPE_SIZE_FAIL, pipe_size, strerror(errno) );
+        pipe_size = 0;
+      }
+      stage->fd[1] = pfd[1];
+      pipeline->stages[i+1].fd[0] = pfd[0];
+    }
+  }
+
+  // Flush so buffered prompt text is not duplicated into the children
+  fflush( stdout );
+
+  for( i = 0 ; i < pipeline->count ; i++ ){
+    stage = &pipeline->stages[i];
+    if ( pipeline->timed ){
+      clock_gettime( CLOCK_MONOTONIC, &stage->start );
+    }
+
+    // A builtin in a pipeline runs in a child of its own, without an exec
+    if ( stage->builtin != NULL ){
+      stage->pid = proc_fork( pipeline, stage );
+      continue;
+    }
+
+    // Resolved in the parent so the hash table remembers it
+    stage->path = command_hash_lookup( stage->run_buffer_array[0] );
+    if ( stage->path == NULL ){
+      fprintf( stderr, COMMAND_NOT_FOUND "\n", stage->run_buffer_array[0] );
+      stage->pid = -1;
+      continue;
+    }
+
+    stage->pid = executor.workers.count > 0 ?
+      proc_worker( pipeline, stage ) :
+      SPAWN ? proc_spawn( pipeline, stage ) : proc_fork( pipeline, stage );
+  }
+
+  // Close the parent copies so the readers see EOF
+  if ( pipeline_close_fds( pipeline ) == -1 ){
+    syserror( CLOSE_PIPE_FAIL );
+  }
+
+  return 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+pid_t proc_spawn( struct pipeline* pipeline, struct stage* stage ){
+  // Starts one stage of the pipeline with posix_spawn
+
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attributes;
+  struct redirect* redirect;
+  char** envp;
+  pid_t pid;
+  int status;
+  unsigned int i;
+
+  // File redirects take priority over the pipe. They are opened here so a
+  // failure can be told apart from a missing command.
+  if ( stage_open_files( stage ) == -1 ){
+    return -1;
+  }
+
+  if ( posix_spawn_file_actions_init( &actions ) != 0 ){
+    syserror( FORK_FAIL );
+  }
+
+  // Pipes from the neighbouring stages, every other pipe end is close on
+  // exec so nothing has to be closed
+  if ( stage->fd[0] != 0 ){
+    posix_spawn_file_actions_adddup2( &actions, stage->fd[0], 0 );
+  }
+  if ( stage->fd[1] != 1 ){
+    posix_spawn_file_actions_adddup2( &actions, stage->fd[1], 1 );
+  }
+
+  for( i = 0 ; i < stage->redirect_count ; i++ ){
+    redirect = &stage->redirects[i];
+    posix_spawn_file_actions_adddup2( &actions,
+      redirect->type == REDIRECT_DUP ? redirect->source : redirect->open_fd,
+      redirect->fd );
+  }
+
+  // With job control every pipeline is a process group of its own, and
+  // the signals the shell ignores are put back for the child
+  if ( posix_spawnattr_init( &attributes ) != 0 ){
+    syserror( FORK_FAIL );
+  }
+  posix_spawnattr_setsigdefault( &attributes,
+    &executor.job_table.job_signals );
+  if ( executor.job_table.job_control ){
+    posix_spawnattr_setpgroup( &attributes, pipeline->pgid );
+    posix_spawnattr_setflags( &attributes,
+      POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF );
+  }
+  else{
+    posix_spawnattr_setflags( &attributes, POSIX_SPAWN_SETSIGDEF );
+  }
+
+  envp = stage->envp != NULL ? stage->envp : variables_envp();
+  status = posix_spawn( &pid, stage->path, &actions, &attributes,
+    stage->run_buffer_array, envp );
+
+  // A hashed command that has been moved or removed is searched for again
+  if ( status == ENOENT && stage->path != stage->run_buffer_array[0] ){
+    command_hash_forget( stage->run_buffer_array[0] );
+    stage->path = command_hash_lookup( stage->run_buffer_array[0] );
+    if ( stage->path != NULL ){
+      status = posix_spawn( &pid, stage->path, &actions, &attributes,
+        stage->run_buffer_array, envp );
+    }
+  }
+  posix_spawnattr_destroy( &attributes );
+
+  if ( status == 0 && executor.job_table.job_control && pipeline->pgid == 0 ){
+    pipeline->pgid = pid;
+  }
+  if ( status == 0 ){
+    trace( TRACE_SPAWN, pid, stage->path, stage - pipeline->stages );
+  }
+
+  // The exec fails in the parent, not in a child
+  if ( status != 0 ){
+    if ( status == ENOENT ){
+      fprintf( stderr, COMMAND_NOT_FOUND "\n", stage->run_buffer_array[0] );
+    }
+    else{
+      fprintf( stderr, SPAWN_FAIL, stage->run_buffer_array[0],
+        strerror(status) );
+    }
+  }
+
+  posix_spawn_file_actions_destroy( &actions );
+  stage_close_files( stage );
+
+  return status == 0 ? pid : -1;
+}
+///////////////////////////////////////////////////////////////////////////////
+int proc_builtin( struct stage* stage ){
+  // Runs a builtin in the shell, redirecting around it
+  struct redirect* redirect;
+  struct variable* variable;
+  char** saved;
+  unsigned int i;
+  int status, floor;
+
+  if ( stage_open_files( stage ) == -1 ){
+    return 1;
+  }
+
+  // Each old entry is kept, or the bare name if there was none
+  saved = NULL;
+  if ( stage->assignment_count > 0 ){
+    saved = (char **) malloc( stage->assignment_count * sizeof(char *) );
+    if ( saved == NULL ){
+      syserror( OUT_OF_MEMORY );
+    }
+  }
+  for( i = 0 ; i < stage->assignment_count ; i++ ){
+    variable = variable_find( stage->assignments[i],
+      variable_name_length( stage->assignments[i] ) );
+    saved[i] = variable != NULL ? strdup( variable->entry ) :
+      strndup( stage->assignments[i],
+        variable_name_length( stage->assignments[i] ) );
+    if ( saved[i] == NULL ){
+      syserror( OUT_OF_MEMORY );
+    }
+    variable_assign( stage->assignments[i], false );
+  }
+
+  // Keep the shell's own fds to put back afterwards. One that is not open
+  // is closed again after.
+  fflush( stdout );
+  fflush( stderr );
+  floor = stage_redirect_floor( stage );
+  for( i = 0 ; i < stage->redirect_count ; i++ ){
+    redirect = &stage->redirects[i];
+    redirect->saved_fd = fcntl( redirect->fd, F_DUPFD_CLOEXEC, floor );
+    if ( redirect->saved_fd == -1 && errno != EBADF ){
+      syserror( REDIRECT_ERROR );
+    }
+    if ( dup2( redirect->type == REDIRECT_DUP ? redirect->source :
+        redirect->open_fd, redirect->fd ) == -1 ){
+      // Named as stage_open_files names it, only a copy has a source fd
+      if ( redirect->type == REDIRECT_DUP ){
+        fprintf( stderr, REDIRECT_FAIL, redirect->source, strerror(errno) );
+      }
+      else{
+        fprintf( stderr, SPAWN_FAIL, redirect->type == REDIRECT_STRING ||
+          redirect->type == REDIRECT_HEREDOC ? HEREDOC_NAME : redirect->file,
+          strerror(errno) );
+      }
+      if ( redirect->saved_fd != -1 ){
+        close( redirect->saved_fd );
+      }
+      break;
+    }
+  }
+
+  status = 1;
+  if ( i == stage->redirect_count ){
+    status = stage->builtin->run( stage->run_buffer_array );
+    trace( TRACE_BUILTIN, 0, stage->run_buffer_array[0], status );
+  }
+  fflush( stdout );
+  fflush( stderr );
+
+  // Put back in reverse, so an fd redirected twice ends up as it started
+  while( i-- > 0 ){
+    redirect = &stage->redirects[i];
+    if ( redirect->saved_fd == -1 ){
+      close( redirect->fd );
+    }
+    else{
+      if ( dup2( redirect->saved_fd, redirect->fd ) == -1 ){
+        syserror( REDIRECT_ERROR );
+      }
+      close( redirect->saved_fd );
+    }
+    redirect->saved_fd = -1;
+  }
+  stage_close_files( stage );
+
+  // Undone in reverse too, for a name assigned twice
+  for( i = stage->assignment_count ; i-- > 0 ; ){
+    if ( strchr( saved[i], '=' ) != NULL ){
+      variable_assign( saved[i], false );
+    }
+    else{
+      variable_unset( saved[i] );
+    }
+    free( saved[i] );
+  }
+  free( saved );
+
+  return status;
+}
+///////////////////////////////////////////////////////////////////////////////
+int stage_open_files( struct stage* stage ){
+  // Opens the redirect files of a stage close on exec
+  struct redirect* redirect;
+  const char* name;
+  unsigned int i;
+  int flags, floor, fd;
+
+  floor = stage_redirect_floor( stage );
+  for( i = 0 ; i < stage->redirect_count ; i++ ){
+    redirect = &stage->redirects[i];
+    redirect->open_fd = -1;
+    if ( redirect->type == REDIRECT_DUP ){
+      continue;
+    }
+
+    name = redirect->file;
+    if ( redirect->type == REDIRECT_STRING ||
+        redirect->type == REDIRECT_HEREDOC ){
+      name = HEREDOC_NAME;
+      fd = redirect_text( redirect->file,
+        redirect->type == REDIRECT_STRING );
+    }
+    else if ( redirect->type == REDIRECT_PROCESS_IN ||
+        redirect->type == REDIRECT_PROCESS_OUT ){
+      fd = proc_substitute( redirect );
+    }
+    else{
+      flags = redirect->type == REDIRECT_INPUT ? O_RDONLY :
+        redirect->type == REDIRECT_APPEND ? O_WRONLY | O_CREAT | O_APPEND :
+        O_WRONLY | O_CREAT | O_TRUNC;
+      fd = open( redirect->file, flags | O_CLOEXEC, 0644 );
+    }
+    if ( fd == -1 ){
+      fprintf( stderr, SPAWN_FAIL, name, strerror(errno) );
+      stage_close_files( stage );
+      return -1;
+    }
+
+    // Out of the way of the fds the redirects write to
+    if ( fd < floor ){
+      redirect->open_fd = fcntl( fd, F_DUPFD_CLOEXEC, floor );
+      close( fd );
+      if ( redirect->open_fd == -1 ){
+        fprintf( stderr, SPAWN_FAIL, name, strerror(errno) );
+        stage_close_files( stage );
+        return -1;
+      }
+    }
+    else{
+      redirect->open_fd = fd;
+    }
+  }
+
+  return 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+int redirect_text( const char* text, bool newline ){
+  // A pipe for what fits in one write, a memfd for the rest
+  size_t length;
+  int pfd[2];
+  int fd;
+
+  length = strlen( text );
+  if ( length + newline <= PIPE_BUF ){
+    if ( pipe2( pfd, O_CLOEXEC ) == -1 ){
+      return -1;
+    }
+    if ( plumb_write( pfd[1], text, length ) == -1 ||
+        (newline && plumb_write( pfd[1], "\n", 1 ) == -1) ){
+      close( pfd[0] );
+      pfd[0] = -1;
+    }
+    close( pfd[1] );
+    return pfd[0];
+  }
+
+  fd = memfd_create( HEREDOC_NAME, MFD_CLOEXEC );
+  if ( fd == -1 ){
+    return -1;
+  }
+  if ( plumb_write( fd, text, length ) == -1 ||
+      (newline && plumb_write( fd, "\n", 1 ) == -1) ||
+      lseek( fd, 0, SEEK_SET ) == -1 ){
+    close( fd );
+    return -1;
+  }
+
+  return fd;
+}
+///////////////////////////////////////////////////////////////////////////////
+int proc_substitute( struct redirect* redirect ){
+  // Forks the shell to run the command on one end of a pipe
+  struct command_list list;
+  char* line;
+  pid_t pid;
+  int pfd[2];
+  int end;
+
+  if ( pipe2( pfd, O_CLOEXEC ) == -1 ){
+    return -1;
+  }
+
+  // The child writes its stdout for <(cmd) and reads its stdin for >(cmd)
+  end = redirect->type == REDIRECT_PROCESS_IN ? 1 : 0;
+  fflush( stdout );
+
+  switch( pid = fork() ){
+    case -1:
+      close( pfd[0] );
+      close( pfd[1] );
+      return -1;
+    case  0:
+      if ( dup2( pfd[end], end ) == -1 ){
+        syserror( PFD_OPEN_ERROR );
+      }
+      close( pfd[0] );
+      close( pfd[1] );
+
+      // As if it had exec'd, or it would hold the pipeline's pipes open
+      // while it waits
+      proc_close_fds( -1 );
+      executor.workers.count = 0;
+
+      // Its commands stay in the shell's process group
+      executor.job_table.job_control = false;
+      memset( &list, 0, sizeof(list) );
+      line = strdup( redirect->file );
+      if ( line == NULL ){
+        syserror( OUT_OF_MEMORY );
+      }
+      if ( parse_text( line, &list ) ){
+        proc_command_list( &list );
+      }
+      else{
+        executor.status = 2;
+      }
+      fflush( stdout );
+      exit( executor.status );
+    default:
+      trace( TRACE_FORK, pid, redirect->file, redirect->fd );
+      break;
+  }
+
+  close( pfd[end] );
+  return pfd[1 - end];
+}
+///////////////////////////////////////////////////////////////////////////////
+void stage_close_files( struct stage* stage ){
+  // Closes what stage_open_files opened
+  unsigned int i;
+
+  for( i = 0 ; i < stage->redirect_count ; i++ ){
+    if ( stage->redirects[i].open_fd != -1 ){
+      close( stage->redirects[i].open_fd );
+      stage->redirects[i].open_fd = -1;
+    }
+  }
+}
+///////////////////////////////////////////////////////////////////////////////
+int stage_redirect_floor( struct stage* stage ){
+  // Lowest fd above every one the redirects name
+  unsigned int i;
+  int floor = 3;
+
+  for( i = 0 ; i < stage->redirect_count ; i++ ){
+    if ( stage->redirects[i].fd >= floor ){
+      floor = stage->redirects[i].fd + 1;
+    }
+    if ( stage->redirects[i].type == REDIRECT_DUP &&
+        stage->redirects[i].source >= floor ){
+      floor = stage->redirects[i].source + 1;
+    }
+  }
+
+  return floor;
+}
+///////////////////////////////////////////////////////////////////////////////
+pid_t proc_fork( struct pipeline* pipeline, struct stage* stage ){
+  // Executes the fork exec for one stage of the pipeline
+
+  char concat_string_buffer[BUFFER_SIZE];
+  struct redirect* redirect;
+  char** envp;
+  pid_t pid;
+  int status, i;
+
+  // Opened in the shell, as proc_spawn does
+  if ( stage_open_files( stage ) == -1 ){
+    return -1;
+  }
+
+  // Made before the fork so the shell keeps the envp for the next command
+  envp = NULL;
+  if ( stage->builtin == NULL ){
+    envp = stage->envp != NULL ? stage->envp : variables_envp();
+  }
+
+  switch ( pid = fork() ){
+    case -1:
+      syserror( FORK_FAIL );
+      break;
+    case  0:
+      // Join the pipeline's process group and undo what the shell ignores
+      if ( executor.job_table.job_control ){
+        setpgid( 0, pipeline->pgid );
+      }
+      pool_forget();
+      for( i = 1 ; i < NSIG ; i++ ){
+        if ( sigismember( &executor.job_table.job_signals, i ) == 1 ){
+          signal( i, SIG_DFL );
+        }
+      }
+
+      // Pipes from the neighbouring stages
+      if ( stage->fd[0] != 0 && dup2( stage->fd[0], 0 ) == -1 ){
+        syserror( STDIN_CLOSE_ERROR );
+      }
+      if ( stage->fd[1] != 1 && dup2( stage->fd[1], 1 ) == -1 ){
+        syserror( STDOUT_CLOSE_ERROR );
+      }
+
+      // Closed first, as a redirect may land on a pipe end's number
+      if ( pipeline_close_fds( pipeline ) == -1 ){
+        syserror( PFD_CLOSE_ERROR );
+      }
+
+      // File redirects take priority over the pipe, in the order written
+      for( i = 0 ; i < (int) stage->redirect_count ; i++ ){
+        redirect = &stage->redirects[i];
+        if ( dup2( redirect->type == REDIRECT_DUP ? redirect->source :
+            redirect->open_fd, redirect->fd ) == -1 ){
+          syserror( REDIRECT_ERROR );
+        }
+      }
+
+      if ( stage->builtin != NULL ){
+        status = stage->builtin->run( stage->run_buffer_array );
+        fflush( stdout );
+        exit( status );
+      }
+
+      trace( TRACE_EXEC, 0, stage->path, 0 );
+      execve( stage->path, (char** ) stage->run_buffer_array, envp );
+      snprintf( concat_string_buffer, BUFFER_SIZE, COMMAND_NOT_FOUND,
+        stage->run_buffer_array[0]);
+      syserror( concat_string_buffer );
+      break;
+    default:
+      trace( TRACE_FORK, pid, stage->run_buffer_array[0],
+        stage - pipeline->stages );
+      stage_close_files( stage );
+
+      // Set here too so the group exists before the parent uses it
+      if ( executor.job_table.job_control ){
+        if ( pipeline->pgid == 0 ){
+          pipeline->pgid = pid;
+        }
+        setpgid( pid, pipeline->pgid );
+      }
+      break;
+  }
+
+  return pid;
+}
+///////////////////////////////////////////////////////////////////////////////
+void proc_close_fds( int keep ){
+  // Closes the ranges between stderr, keep and the trace fd
+  int open[2];
+  int low, i;
+
+  open[0] = keep < executor.trace_fd ? keep : executor.trace_fd;
+  open[1] = keep < executor.trace_fd ? executor.trace_fd : keep;
+  low = 3;
+  for( i = 0 ; i < 2 ; i++ ){
+    if ( open[i] >= low ){
+      if ( open[i] > low ){
+        close_range( low, open[i] - 1, 0 );
+      }
+      low = open[i] + 1;
+    }
+  }
+  close_range( low, ~0U, 0 );
+}
+///////////////////////////////////////////////////////////////////////////////
+void pool_refill( void ){
+  // Forks or lets go of workers to match WORKERS_ENV
+  struct worker_pool* pool = &executor.workers;
+  const char* env;
+  long size;
+
+  env = variable_value( WORKERS_ENV );
+  size = env != NULL ? strtol( env, NULL, 10 ) : 0;
+  if ( size < 0 ){
+    size = 0;
+  }
+  if ( size > WORKERS_MAX ){
+    size = WORKERS_MAX;
+  }
+
+  // A worker reads the end of its socket and exits, to be reaped later
+  while( pool->count > size ){
+    pool->count -= 1;
+    close( pool->sockets[pool->count] );
+  }
+  while( pool->count < size && worker_start() == 0 ){
+  }
+}
+///////////////////////////////////////////////////////////////////////////////
+void pool_forget( void ){
+  // Drops the pool in a child
+  int i;
+
+  for( i = 0 ; i < executor.workers.count ; i++ ){
+    close( executor.workers.sockets[i] );
+  }
+  executor.workers.count = 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+int worker_start( void ){
+  // Forks a worker that waits on its end of a new socket pair
+  struct worker_pool* pool = &executor.workers;
+  ssize_t status;
+  char ready;
+  int sv[2];
+  pid_t pid;
+
+  if ( socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv ) == -1 ){
+    return -1;
+  }
+
+  fflush( stdout );
+  switch( pid = fork() ){
+    case -1:
+      close( sv[0] );
+      close( sv[1] );
+      return -1;
+    case  0:
+      // Nothing of the shell's is held open while it waits
+      proc_close_fds( sv[1] );
+      worker_main( sv[1] );
+      break;
+    default:
+      break;
+  }
+
+  // Its start is part of the refill, not of the command it is given
+  close( sv[1] );
+  while( (status = read( sv[0], &ready, 1 )) == -1 && errno == EINTR ){
+  }
+  if ( status != 1 ){
+    close( sv[0] );
+    return -1;
+  }
+  pool->sockets[pool->count] = sv[0];
+  pool->pids[pool->count] = pid;
+  pool->count += 1;
+  trace( TRACE_WORKER, pid, NULL, pool->count );
+
+  return 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+void worker_main( int socket ){
+  // Receives one command, puts its fds in place and execs it
+  struct worker_request request;
+  struct worker_redirect* redirects;
+  struct msghdr message;
+  struct iovec iov;
+  struct cmsghdr* cmsg;
+  union{
+    char buffer[CMSG_SPACE(WORKER_FDS * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  char concat_string_buffer[BUFFER_SIZE];
+  char** argv;
+  char** envp;
+  char* data;
+  char* string;
+  int fds[WORKER_FDS];
+  int count, sent, fd, i;
+  uint32_t j;
+  ssize_t status;
+  size_t received, size;
+
+  // The shell waits for this before it counts the worker as idle
+  if ( write( socket, "", 1 ) != 1 ){
+    _exit( 1 );
+  }
+
+  // The fds come with the first bytes of the request
+  memset( &message, 0, sizeof(message) );
+  iov.iov_base = &request;
+  iov.iov_len = sizeof(request);
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buffer;
+  message.msg_controllen = sizeof(control.buffer);
+  while( (status = recvmsg( socket, &message, MSG_CMSG_CLOEXEC )) == -1 &&
+      errno == EINTR ){
+  }
+  if ( status <= 0 ){
+    _exit( 0 );
+  }
+
+  count = 0;
+  for( cmsg = CMSG_FIRSTHDR( &message ) ; cmsg != NULL ;
+      cmsg = CMSG_NXTHDR( &message, cmsg ) ){
+    if ( cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS ){
+      count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy( fds, CMSG_DATA( cmsg ), count * sizeof(int) );
+    }
+  }
+
+  // The rest of the request, then the redirects and strings after it
+  received = status;
+  data = (char *) &request;
+  size = sizeof(request);
+  while( received < size || data == (char *) &request ){
+    if ( received == size ){
+      data = (char *) malloc( request.size );
+      if ( data == NULL ){
+        syserror( OUT_OF_MEMORY );
+      }
+      received = 0;
+      size = request.size;
+      continue;
+    }
+    status = read( socket, data + received, size - received );
+    if ( status == -1 && errno == EINTR ){
+      continue;
+    }
+    if ( status <= 0 ){
+      _exit( 1 );
+    }
+    received += status;
+  }
+  close( socket );
+
+  redirects = (struct worker_redirect *) data;
+  string = (char *) (redirects + request.redirects);
+  argv = (char **) malloc( (request.argc + request.envc + 2) *
+    sizeof(char *) );
+  if ( argv == NULL ){
+    syserror( OUT_OF_MEMORY );
+  }
+  envp = argv + request.argc + 1;
+  string += strlen( string ) + 1;
+  for( j = 0 ; j < request.argc + request.envc + 1 ; j++ ){
+    if ( j == request.argc ){
+      argv[j] = NULL;
+      continue;
+    }
+    argv[j] = string;
+    string += strlen( string ) + 1;
+  }
+  envp[request.envc] = NULL;
+
+  if ( request.pgid != -1 ){
+    setpgid( 0, request.pgid );
+  }
+
+  // Stdin, stdout and stderr, then the redirects in order, each moved out
+  // of the way first as stage_open_files does
+  sent = 4;
+  for( j = 0 ; j < request.redirects ; j++ ){
+    sent += redirects[j].source == -1;
+  }
+  if ( count != sent ){
+    _exit( 1 );
+  }
+  for( i = 0 ; i < count ; i++ ){
+    if ( fds[i] < request.floor ){
+      fd = fcntl( fds[i], F_DUPFD_CLOEXEC, request.floor );
+      close( fds[i] );
+      fds[i] = fd;
+    }
+  }
+  for( i = 0 ; i < 3 ; i++ ){
+    if ( dup2( fds[i], i ) == -1 ){
+      syserror( REDIRECT_ERROR );
+    }
+  }
+
+  // Where the shell is now, not where it was when the worker was forked
+  if ( fchdir( fds[i] ) == -1 ){
+    syserror( WORKER_CHDIR_ERROR );
+  }
+  close( fds[i++] );
+  umask( request.mask );
+
+  for( j = 0 ; j < request.redirects ; j++ ){
+    if ( dup2( redirects[j].source == -1 ? fds[i++] : redirects[j].source,
+        redirects[j].fd ) == -1 ){
+      syserror( REDIRECT_ERROR );
+    }
+  }
+
+  for( i = 1 ; i < NSIG ; i++ ){
+    if ( sigismember( &executor.job_table.job_signals, i ) == 1 ){
+      signal( i, SIG_DFL );
+    }
+  }
+
+  string = (char *) (redirects + request.redirects);
+  trace( TRACE_EXEC, 0, string, 0 );
+  execve( string, argv, envp );
+  snprintf( concat_string_buffer, BUFFER_SIZE, COMMAND_NOT_FOUND, argv[0] );
+  syserror( concat_string_buffer );
+}
+///////////////////////////////////////////////////////////////////////////////
+pid_t proc_worker( struct pipeline* pipeline, struct stage* stage ){
+  // Sends the stage to the newest idle worker
+  struct worker_pool* pool = &executor.workers;
+  struct worker_request request;
+  struct worker_redirect* redirects;
+  struct redirect* redirect;
+  struct msghdr message;
+  struct iovec iov;
+  union{
+    char buffer[CMSG_SPACE(WORKER_FDS * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  char** envp;
+  char* data;
+  char* string;
+  int fds[WORKER_FDS];
+  int count, socket, directory;
+  unsigned int i, j;
+  size_t size, sent;
+  ssize_t status;
+  pid_t pid;
+
+  // A copy is only made in the worker from an fd it was given
+  count = 4;
+  for( i = 0 ; i < stage->redirect_count ; i++ ){
+    redirect = &stage->redirects[i];
+    if ( redirect->type != REDIRECT_DUP ){
+      count += 1;
+      continue;
+    }
+    for( j = 0 ; j < i && stage->redirects[j].fd != redirect->source ; j++ ){
+    }
+    if ( redirect->source > 2 && j == i ){
+      count = WORKER_FDS + 1;
+    }
+  }
+  if ( count > WORKER_FDS ){
+    return SPAWN ? proc_spawn( pipeline, stage ) :
+      proc_fork( pipeline, stage );
+  }
+
+  // The worker changes to the shell's directory, which may have gone
+  directory = open( ".", O_PATH | O_DIRECTORY | O_CLOEXEC );
+  if ( directory == -1 ){
+    return SPAWN ? proc_spawn( pipeline, stage ) :
+      proc_fork( pipeline, stage );
+  }
+
+  if ( stage_open_files( stage ) == -1 ){
+    close( directory );
+    return -1;
+  }
+  envp = stage->envp != NULL ? stage->envp : variables_envp();
+
+  // The request, the redirects and the strings in one block
+  memset( &request, 0, sizeof(request) );
+  request.argc = stage->args_count + 1;
+  request.redirects = stage->redirect_count;
+  request.floor = stage_redirect_floor( stage );
+  request.pgid = executor.job_table.job_control ? pipeline->pgid : -1;
+  request.mask = umask( 0 );
+  umask( request.mask );
+  size = sizeof(request) + stage->redirect_count *
+    sizeof(struct worker_redirect) + strlen( stage->path ) + 1;
+  for( i = 0 ; i < request.argc ; i++ ){
+    size += strlen( stage->run_buffer_array[i] ) + 1;
+  }
+  for( ; envp[request.envc] != NULL ; request.envc++ ){
+    size += strlen( envp[request.envc] ) + 1;
+  }
+  request.size = size - sizeof(request);
+
+  data = (char *) malloc( size );
+  if ( data == NULL ){
+    syserror( OUT_OF_MEMORY );
+  }
+  memcpy( data, &request, sizeof(request) );
+  redirects = (struct worker_redirect *) (data + sizeof(request));
+  fds[0] = stage->fd[0];
+  fds[1] = stage->fd[1];
+  fds[2] = 2;
+  fds[3] = directory;
+  count = 4;
+  for( i = 0 ; i < stage->redirect_count ; i++ ){
+    redirect = &stage->redirects[i];
+    redirects[i].fd = redirect->fd;
+    redirects[i].source = -1;
+    if ( redirect->type == REDIRECT_DUP ){
+      redirects[i].source = redirect->source;
+    }
+    else{
+      fds[count++] = redirect->open_fd;
+    }
+  }
+  string = (char *) (redirects + stage->redirect_count);
+  string = stpcpy( string, stage->path ) + 1;
+  for( i = 0 ; i < request.argc ; i++ ){
+    string = stpcpy( string, stage->run_buffer_array[i] ) + 1;
+  }
+  for( i = 0 ; i < request.envc ; i++ ){
+    string = stpcpy( string, envp[i] ) + 1;
+  }
+
+  memset( &message, 0, sizeof(message) );
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buffer;
+  message.msg_controllen = CMSG_SPACE(count * sizeof(int));
+  memset( control.buffer, 0, sizeof(control.buffer) );
+  CMSG_FIRSTHDR( &message )->cmsg_level = SOL_SOCKET;
+  CMSG_FIRSTHDR( &message )->cmsg_type = SCM_RIGHTS;
+  CMSG_FIRSTHDR( &message )->cmsg_len = CMSG_LEN(count * sizeof(int));
+  memcpy( CMSG_DATA( CMSG_FIRSTHDR( &message ) ), fds,
+    count * sizeof(int) );
+
+  // A worker that has died is passed over, the fds go with the first
+  // bytes and the rest follows
+  pid = -1;
+  while( pid == -1 && pool->count > 0 ){
+    pool->count -= 1;
+    socket = pool->sockets[pool->count];
+    pid = pool->pids[pool->count];
+    iov.iov_base = data;
+    iov.iov_len = size;
+    status = sendmsg( socket, &message, MSG_NOSIGNAL );
+    for( sent = status > 0 ? status : 0 ; status > 0 && sent < size ; ){
+      status = send( socket, data + sent, size - sent, MSG_NOSIGNAL );
+      sent += status > 0 ? status : 0;
+    }
+    if ( status <= 0 ){
+      pid = -1;
+    }
+    close( socket );
+  }
+  free( data );
+  close( directory );
+
+  if ( pid == -1 ){
+    stage_close_files( stage );
+    return SPAWN ? proc_spawn( pipeline, stage ) :
+      proc_fork( pipeline, stage );
+  }
+
+  // Set here too, as proc_fork does
+  if ( executor.job_table.job_control ){
+    if ( pipeline->pgid == 0 ){
+      pipeline->pgid = pid;
+    }
+    setpgid( pid, pipeline->pgid );
+  }
+  trace( TRACE_HANDOFF, pid, stage->path, stage - pipeline->stages );
+  stage_close_files( stage );
+
+  return pid;
+}
+///////////////////////////////////////////////////////////////////////////////
+const char* command_hash_lookup( const char* name ){
+  // Finds the full path of a command, searching PATH only on a miss
+  struct command_hash* command_hash = &executor.command_hash;
+  struct hash_entry* entry;
+  const char* path_env;
+  const char* dir;
+  const char* dir_end;
+  size_t dir_length, name_length;
+  struct stat info;
+  unsigned int bucket;
+  char* candidate;
+
+  // A path is run as it is
+  if ( strchr( name, '/' ) != NULL ){
+    return name;
+  }
+
+  path_env = variable_value( "PATH" );
+  if ( path_env == NULL ){
+    path_env = DEFAULT_PATH;
+  }
+
+  // Any change to PATH makes every entry suspect
+  if ( command_hash->path_env == NULL ||
+      strcmp( command_hash->path_env, path_env ) != 0 ){
+    command_hash_clear();
+    command_hash->path_env = strdup( path_env );
+    if ( command_hash->path_env == NULL ){
+      syserror( OUT_OF_MEMORY );
+    }
+  }
+
+  bucket = command_hash_bucket( name );
+  for( entry = command_hash->buckets[bucket] ; entry ; entry = entry->next ){
+    if ( strcmp( entry->name, name ) == 0 ){
+      entry->hits += 1;
+      return entry->path;
+    }
+  }
+
+  // Miss, search every directory of PATH in order
+  name_length = strlen( name );
+  for( dir = path_env ; dir != NULL ; dir = *dir_end ? dir_end + 1 : NULL ){
+    dir_end = strchr( dir, ':' );
+    if ( dir_end == NULL ){
+      dir_end = dir + strlen( dir );
+    }
+    dir_length = dir_end - dir;
+
+    if ( command_hash->candidate_size < dir_length + name_length + 3 ){
+      command_hash->candidate_size = 2 * (dir_length + name_length + 3);
+      command_hash->candidate = (char *) realloc( command_hash->candidate,
+        command_hash->candidate_size );
+      if ( command_hash->candidate == NULL ){
+        syserror( OUT_OF_MEMORY );
+      }
+    }
+    candidate = command_hash->candidate;
+
+    // An empty directory is the current one
+    if ( dir_length == 0 ){
+      candidate[0] = '.';
+      dir_length = 1;
+    }
+    else{
+      memcpy( candidate, dir, dir_length );
+    }
+    candidate[dir_length] = '/';
+    memcpy( candidate + dir_length + 1, name, name_length + 1 );
+
+    if ( stat( candidate, &info ) == 0 && S_ISREG(info.st_mode) &&
+        access( candidate, X_OK ) == 0 ){
+      entry = (struct hash_entry *) malloc( sizeof(struct hash_entry) );
+      if ( entry == NULL ||
+          (entry->name = strdup( name )) == NULL ||
+          (entry->path = strdup( candidate )) == NULL ){
+        syserror( OUT_OF_MEMORY );
+      }
+      entry->hits = 1;
+      entry->next = command_hash->buckets[bucket];
+      command_hash->buckets[bucket] = entry;
+      return entry->path;
+    }
+  }
+
+  return NULL;
+}
+///////////////////////////////////////////////////////////////////////////////
+unsigned int command_hash_bucket( const char* name ){
+  // FNV-1a over the command name
+  unsigned int hash = 2166136261u;
+
+  while( *name ){
+    hash = (hash ^ (unsigned char) *name++) * 16777619u;
+  }
+
+  return hash % HASH_SIZE;
+}
+///////////////////////////////////////////////////////////////////////////////
+void command_hash_forget( const char* name ){
+  // Drops one command from the table
+  struct hash_entry** link;
+  struct hash_entry* entry;
+
+  link = &executor.command_hash.buckets[command_hash_bucket( name )];
+  while( (entry = *link) != NULL ){
+    if ( strcmp( entry->name, name ) == 0 ){
+      *link = entry->next;
+      free( entry->name );
+      free( entry->path );
+      free( entry );
+      return;
+    }
+    link = &entry->next;
+  }
+}
+///////////////////////////////////////////////////////////////////////////////
+void command_hash_clear( void ){
+  // Empties the table
+  struct hash_entry* entry;
+  int i;
+
+  for( i = 0 ; i < HASH_SIZE ; i++ ){
+    while( (entry = executor.command_hash.buckets[i]) != NULL ){
+      executor.command_hash.buckets[i] = entry->next;
+      free( entry->name );
+      free( entry->path );
+      free( entry );
+    }
+  }
+  free( executor.command_hash.path_env );
+  executor.command_hash.path_env = NULL;
+}
+///////////////////////////////////////////////////////////////////////////////
+int command_hash_builtin( char* run_buffer_array[] ){
+  // hash lists the table, hash -r clears it and hash name adds name
+  struct hash_entry* entry;
+  bool empty = true;
+  int i, status;
+
+  if ( run_buffer_array[1] == NULL ){
+    for( i = 0 ; i < HASH_SIZE ; i++ ){
+      for( entry = executor.command_hash.buckets[i] ; entry ;
+          entry = entry->next ){
+        if ( empty ){
+          printf( HASH_HEADER );
+          empty = false;
+        }
+        printf( HASH_ENTRY, entry->hits, entry->path );
+      }
+    }
+    if ( empty ){
+      printf( HASH_EMPTY );
+    }
+    return 0;
+  }
+
+  status = 0;
+  for( i = 1 ; run_buffer_array[i] != NULL ; i++ ){
+    if ( strcmp( run_buffer_array[i], "-r" ) == 0 ){
+      command_hash_clear();
+    }
+    else{
+      command_hash_forget( run_buffer_array[i] );
+      if ( command_hash_lookup( run_buffer_array[i] ) == NULL ){
+        fprintf( stderr, HASH_NOT_FOUND, run_buffer_array[i] );
+        status = 1;
+      }
+    }
+  }
+
+  return status;
+}
+///////////////////////////////////////////////////////////////////////////////
+void jobs_init( bool interactive ){
+  // Catches SIGCHLD and, for a terminal, takes it over for job control
+  struct sigaction action;
+  int i;
+
+  memset( &action, 0, sizeof(action) );
+  action.sa_handler = jobs_sigchld;
+  action.sa_flags = SA_RESTART;
+  sigemptyset( &action.sa_mask );
+  sigaction( SIGCHLD, &action, NULL );
+
+  sigemptyset( &executor.job_table.job_signals );
+  executor.job_table.job_control = interactive;
+  if ( !interactive ){
+    return;
+  }
+
+  // The shell ignores the keyboard signals meant for the foreground job
+  sigaddset( &executor.job_table.job_signals, SIGINT );
+  sigaddset( &executor.job_table.job_signals, SIGQUIT );
+  sigaddset( &executor.job_table.job_signals, SIGTSTP );
+  sigaddset( &executor.job_table.job_signals, SIGTTIN );
+  sigaddset( &executor.job_table.job_signals, SIGTTOU );
+  for( i = 1 ; i < NSIG ; i++ ){
+    if ( sigismember( &executor.job_table.job_signals, i ) == 1 ){
+      signal( i, SIG_IGN );
+    }
+  }
+
+  setpgid( 0, 0 );
+  executor.job_table.shell_pgid = getpgrp();
+  tcsetpgrp( 0, executor.job_table.shell_pgid );
+}
+///////////////////////////////////////////////////////////////////////////////
+void jobs_sigchld( int signal ){
+  // Only notes that a child changed, the reaping is done in jobs_update
+  (void) signal;
+  executor.job_table.child_changed = 1;
+}
+///////////////////////////////////////////////////////////////////////////////
+struct job* job_add( struct pipeline* pipeline ){
+  // Copies a started pipeline into the job table
+  struct job_table* table = &executor.job_table;
+  struct job* job;
+  size_t length;
+  char* text;
+  int i, j;
+
+  if ( table->count == table->capacity ){
+    table->capacity = table->capacity ? table->capacity * 2 : 4;
+    table->jobs = (struct job *) realloc( table->jobs,
+      table->capacity * sizeof(struct job) );
+    if ( table->jobs == NULL ){
+      syserror( OUT_OF_MEMORY );
+    }
+  }
+
+  job = &table->jobs[table->count];
+  job->id = table->count ? table->jobs[table->count-1].id + 1 : 1;
+  job->pgid = pipeline->pgid;
+  job->count = pipeline->count;
+  job->processes = (struct job_process *) malloc(
+    pipeline->count * sizeof(struct job_process) );
+  if ( job->processes == NULL ){
+    syserror( OUT_OF_MEMORY );
+  }
+  for( i = 0 ; i < pipeline->count ; i++ ){
+    job->processes[i].pid = pipeline->stages[i].pid;
+    job->processes[i].status = 0;
+    job->processes[i].state =
+      job->processes[i].pid == -1 ? PROCESS_DONE : PROCESS_RUNNING;
+  }
+
+  // The line itself has been cut up, so the text is put back together
+  length = 3;
+  for( i = 0 ; i < pipeline->count ; i++ ){
+    for( j = 0 ; pipeline->stages[i].run_buffer_array[j] != NULL ; j++ ){
+      length += strlen( pipeline->stages[i].run_buffer_array[j] ) + 1;
+    }
+    length += 3;
+  }
+  job->command = text = (char *) malloc( length );
+  if ( text == NULL ){
+    syserror( OUT_OF_MEMORY );
+  }
+  for( i = 0 ; i < pipeline->count ; i++ ){
+    if ( i > 0 ){
+      text = stpcpy( text, " | " );
+    }
+    for( j = 0 ; pipeline->stages[i].run_buffer_array[j] != NULL ; j++ ){
+      if ( j > 0 ){
+        *text++ = ' ';
+      }
+      text = stpcpy( text, pipeline->stages[i].run_buffer_array[j] );
+    }
+  }
+  strcpy( text, pipeline->background ? " &" : "" );
+
+  table->count += 1;
+  return job;
+}
+///////////////////////////////////////////////////////////////////////////////
+void job_remove( struct job* job ){
+  // Frees a job and closes the gap in the table
+  struct job_table* table = &executor.job_table;
+
+  free( job->processes );
+  free( job->command );
+  table->count -= 1;
+  memmove( job, job + 1,
+    (table->jobs + table->count - job) * sizeof(struct job) );
+}
+///////////////////////////////////////////////////////////////////////////////
+enum process_state job_state( struct job_process* processes, int count ){
+  // A job is running while any process runs, stopped while any is stopped
+  enum process_state state = PROCESS_DONE;
+  int i;
+
+  for( i = 0 ; i < count ; i++ ){
+    if ( processes[i].state == PROCESS_RUNNING ){
+      return PROCESS_RUNNING;
+    }
+    if ( processes[i].state == PROCESS_STOPPED ){
+      state = PROCESS_STOPPED;
+    }
+  }
+
+  return state;
+}
+///////////////////////////////////////////////////////////////////////////////
+void job_process_update( struct job_process* process, int status ){
+  // Records what waitpid said about a process
+  trace( TRACE_WAIT, process->pid, NULL, status );
+  if ( WIFSTOPPED(status) ){
+    process->state = PROCESS_STOPPED;
+  }
+  else if ( WIFCONTINUED(status) ){
+    process->state = PROCESS_RUNNING;
+  }
+  else{
+    process->state = PROCESS_DONE;
+    process->status = status;
+  }
+}
+///////////////////////////////////////////////////////////////////////////////
+void jobs_update( void ){
+  // Reaps every child that changed since the last SIGCHLD
+  pid_t pid;
+  int status;
+
+  if ( !executor.job_table.child_changed ){
+    return;
+  }
+  executor.job_table.child_changed = 0;
+
+  while( (pid = waitpid( -1, &status, WNOHANG | WUNTRACED | WCONTINUED ))
+      > 0 ){
+    jobs_record( pid, status );
+  }
+}
+///////////////////////////////////////////////////////////////////////////////
+void jobs_record( pid_t pid, int status ){
+  // Hands a reaped status to the job process it belongs to
+  int i, j;
+
+  for( i = 0 ; i < executor.job_table.count ; i++ ){
+    for( j = 0 ; j < executor.job_table.jobs[i].count ; j++ ){
+      if ( executor.job_table.jobs[i].processes[j].pid == pid ){
+        job_process_update( &executor.job_table.jobs[i].processes[j], status );
+      }
+    }
+  }
+}
+///////////////////////////////////////////////////////////////////////////////
+void jobs_notify( void ){
+  // Drops finished jobs, telling a terminal user about them
+  struct job* job;
+  int i;
+
+  for( i = 0 ; i < executor.job_table.count ; ){
+    job = &executor.job_table.jobs[i];
+    if ( job_state( job->processes, job->count ) == PROCESS_DONE ){
+      if ( executor.job_table.job_control ){
+        printf( JOB_ENTRY, job->id,
+          i == executor.job_table.count - 1 ? '+' : ' ',
+          JOB_DONE_STRING, job->command );
+      }
+      job_remove( job );
+    }
+    else{
+      i++;
+    }
+  }
+}
+///////////////////////////////////////////////////////////////////////////////
+enum process_state job_wait( struct job_process* processes, int count,
+    pid_t pgid, bool foreground ){
+  // Waits until every process is done or the job is stopped
+  enum process_state state;
+  int status, i;
+
+  // The foreground job gets the terminal so ^C and ^Z go to it
+  if ( foreground && executor.job_table.job_control && pgid > 0 ){
+    tcsetpgrp( 0, pgid );
+  }
+
+  for( i = 0 ; i < count ; i++ ){
+    while( processes[i].state == PROCESS_RUNNING ){
+      // wait4 costs no more than waitpid and keeps the child's usage
+      if ( wait4( processes[i].pid, &status, WUNTRACED,
+          &processes[i].usage ) == -1 ){
+        if ( errno == EINTR ){
+          continue;
+        }
+        // Reaped somewhere that did not record it, so its status is lost
+        // and it counts as failed, not as 0
+        processes[i].state = PROCESS_DONE;
+        processes[i].status = W_EXITCODE( STATUS_UNKNOWN, 0 );
+        break;
+      }
+      clock_gettime( CLOCK_MONOTONIC, &processes[i].end );
+      job_process_update( &processes[i], status );
+    }
+  }
+  state = job_state( processes, count );
+
+  if ( foreground && executor.job_table.job_control && pgid > 0 ){
+    tcsetpgrp( 0, executor.job_table.shell_pgid );
+  }
+
+  return state;
+}
+///////////////////////////////////////////////////////////////////////////////
+int job_exit_status( struct job_process* processes, int count ){
+  // Status of the last process, as sh reports it
+  int status, i;
+
+  if ( count == 0 ){
+    return 0;
+  }
+
+  // With pipefail the last stage that failed decides
+  i = count - 1;
+  while( executor.pipefail && i > 0 && processes[i].status == 0 ){
+    i--;
+  }
+  status = processes[i].status;
+  if ( WIFSIGNALED(status) ){
+    return 128 + WTERMSIG(status);
+  }
+  if ( WIFSTOPPED(status) ){
+    return 128 + WSTOPSIG(status);
+  }
+  return WEXITSTATUS(status);
+}
+///////////////////////////////////////////////////////////////////////////////
+void job_continue( struct job* job ){
+  // Sends SIGCONT to the whole job
+  int i;
+
+  for( i = 0 ; i < job->count ; i++ ){
+    if ( job->processes[i].state == PROCESS_STOPPED ){
+      job->processes[i].state = PROCESS_RUNNING;
+    }
+  }
+
+  if ( job->pgid > 0 ){
+    kill( -job->pgid, SIGCONT );
+    return;
+  }
+  for( i = 0 ; i < job->count ; i++ ){
+    if ( job->processes[i].state != PROCESS_DONE ){
+      kill( job->processes[i].pid, SIGCONT );
+    }
+  }
+}
+///////////////////////////////////////////////////////////////////////////////
+struct job* job_find( const char* spec, const char* builtin ){
+  // Finds the job named by %id, a pid or an id, or the newest job
+  int i, j, number;
+
+  if ( spec == NULL ){
+    if ( executor.job_table.count == 0 ){
+      fprintf( stderr, JOB_NO_CURRENT, builtin );
+      return NULL;
+    }
+    return &executor.job_table.jobs[executor.job_table.count-1];
+  }
+
+  number = atoi( spec[0] == '%' ? spec + 1 : spec );
+  for( i = 0 ; i < executor.job_table.count ; i++ ){
+    if ( spec[0] != '%' ){
+      for( j = 0 ; j < executor.job_table.jobs[i].count ; j++ ){
+        if ( executor.job_table.jobs[i].processes[j].pid == number ){
+          return &executor.job_table.jobs[i];
+        }
+      }
+    }
+  }
+  for( i = 0 ; i < executor.job_table.count ; i++ ){
+    if ( executor.job_table.jobs[i].id == number ){
+      return &executor.job_table.jobs[i];
+    }
+  }
+
+  fprintf( stderr, JOB_NOT_FOUND, builtin, spec );
+  return NULL;
+}
+///////////////////////////////////////////////////////////////////////////////
+int builtin_jobs( char* run_buffer_array[] ){
+  // Lists the job table, then forgets the finished jobs
+  struct job* job;
+  const char* state;
+  int i;
+
+  (void) run_buffer_array;
+
+  jobs_update();
+  for( i = 0 ; i < executor.job_table.count ; i++ ){
+    job = &executor.job_table.jobs[i];
+    switch( job_state( job->processes, job->count ) ){
+      case PROCESS_RUNNING:
+        state = JOB_RUNNING_STRING;
+        break;
+      case PROCESS_STOPPED:
+        state = JOB_STOPPED_STRING;
+        break;
+      default:
+        state = JOB_DONE_STRING;
+        break;
+    }
+    printf( JOB_ENTRY, job->id, i == executor.job_table.count - 1 ? '+' : ' ',
+      state, job->command );
+  }
+
+  for( i = 0 ; i < executor.job_table.count ; ){
+    job = &executor.job_table.jobs[i];
+    if ( job_state( job->processes, job->count ) == PROCESS_DONE ){
+      job_remove( job );
+    }
+    else{
+      i++;
+    }
+  }
+
+  return 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+int builtin_wait( char* run_buffer_array[] ){
+  // Waits for the named jobs, or every job
+  struct job* job;
+  int status, i;
+
+  status = 0;
+  if ( run_buffer_array[1] == NULL ){
+    // A job that stops is kept for fg and bg and the next one waited for
+    for( i = 0 ; i < executor.job_table.count ; ){
+      job = &executor.job_table.jobs[i];
+      if ( job_wait( job->processes, job->count, job->pgid, false ) ==
+          PROCESS_STOPPED ){
+        status = 128 + SIGTSTP;
+        i++;
+        continue;
+      }
+      status = job_exit_status( job->processes, job->count );
+      job_remove( job );
+    }
+    return status;
+  }
+
+  for( i = 1 ; run_buffer_array[i] != NULL ; i++ ){
+    job = job_find( run_buffer_array[i], WAIT_STRING );
+    if ( job == NULL ){
+      status = 127;
+      continue;
+    }
+    job_wait( job->processes, job->count, job->pgid, false );
+    status = job_exit_status( job->processes, job->count );
+    if ( job_state( job->processes, job->count ) == PROCESS_DONE ){
+      job_remove( job );
+    }
+  }
+
+  return status;
+}
+///////////////////////////////////////////////////////////////////////////////
+int builtin_fg( char* run_buffer_array[] ){
+  // Continues a job in the foreground and waits for it
+  struct job* job;
+  int status;
+
+  job = job_find( run_buffer_array[1], FG_STRING );
+  if ( job == NULL ){
+    return 1;
+  }
+
+  printf( "%s\n", job->command );
+  fflush( stdout );
+  job_continue( job );
+
+  if ( job_wait( job->processes, job->count, job->pgid, true ) ==
+      PROCESS_STOPPED ){
+    printf( JOB_ENTRY, job->id, '+', JOB_STOPPED_STRING, job->command );
+    return 128 + SIGTSTP;
+  }
+
+  status = job_exit_status( job->processes, job->count );
+  job_remove( job );
+  return status;
+}
+///////////////////////////////////////////////////////////////////////////////
+int builtin_bg( char* run_buffer_array[] ){
+  // Continues a stopped job in the background
+  struct job* job;
+
+  job = job_find( run_buffer_array[1], BG_STRING );
+  if ( job == NULL ){
+    return 1;
+  }
+
+  job_continue( job );
+  printf( JOB_RESUMED, job->id, job->command );
+
+  return 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+int builtin_parallel( char* run_buffer_array[] ){
+  // Runs each argument as a pipeline, several at a time
+
+  struct command_list list;
+  struct parallel_job* jobs;
+  struct parallel_job* job;
+  struct pipeline* pipeline;
+  bool keep_order = false, job_control;
+  long limit = 0, cores;
+  int total, next, running, printed, failed, status, i, j;
+  char* line;
+  char* end;
+  pid_t pid;
+
+  for( i = 1 ; run_buffer_array[i] != NULL &&
+      run_buffer_array[i][0] == '-' ; i++ ){
+    if ( strcmp( run_buffer_array[i], "--" ) == 0 ){
+      i++;
+      break;
+    }
+    if ( strcmp( run_buffer_array[i], "-k" ) == 0 ){
+      keep_order = true;
+      continue;
+    }
+    if ( strcmp( run_buffer_array[i], "-j" ) == 0 &&
+        run_buffer_array[i+1] != NULL ){
+      limit = strtol( run_buffer_array[++i], &end, 10 );
+      if ( *end == '\0' && limit > 0 ){
+        continue;
+      }
+    }
+    fprintf( stderr, PARALLEL_USAGE );
+    return 2;
+  }
+
+  // More jobs than cores would only take turns on them
+  cores = sysconf( _SC_NPROCESSORS_ONLN );
+  if ( cores < 1 ){
+    cores = 1;
+  }
+  if ( limit == 0 || limit > cores ){
+    limit = cores;
+  }
+
+  // Every command is parsed before any is started
+  memset( &list, 0, sizeof(list) );
+  for( total = 0 ; run_buffer_array[i+total] != NULL ; total++ ){
+    // Cut up a copy, so the argument is left whole for the errors
+    line = arena_strndup( &list.arena, run_buffer_array[i+total],
+      strlen( run_buffer_array[i+total] ) );
+    if ( !parse_text( line, &list ) ){
+      command_list_free( &list );
+      return 2;
+    }
+    if ( list.count != total + 1 || list.pipelines[total].background ){
+      fprintf( stderr, PARALLEL_NOT_PIPELINE, run_buffer_array[i+total] );
+      command_list_free( &list );
+      return 2;
+    }
+  }
+
+  jobs = (struct parallel_job *) arena_alloc( &list.arena,
+    total * sizeof(struct parallel_job) );
+
+  // The jobs share the shell's process group, so they are the foreground
+  // and a ^C reaches all of them
+  job_control = executor.job_table.job_control;
+  executor.job_table.job_control = false;
+
+  next = running = printed = failed = 0;
+  while( printed < total ){
+
+    // Keep limit jobs running until every one has been started
+    while( running < limit && next < total ){
+      job = &jobs[next];
+      pipeline = &list.pipelines[next];
+      next++;
+
+      // Each job writes to a file of its own in memory, shown once it ends
+      job->output_fd = memfd_create( PARALLEL_STRING, MFD_CLOEXEC );
+      pipeline->out_fd = job->output_fd != -1 ? job->output_fd : 1;
+
+      job->count = pipeline->count;
+      job->processes = (struct job_process *) arena_alloc( &list.arena,
+        pipeline->count * sizeof(struct job_process) );
+      job->running = 0;
+      pipeline_expand( pipeline, &list.arena );
+      if ( pipeline_start( pipeline ) == -1 ){
+        for( j = 0 ; j < pipeline->count ; j++ ){
+          pipeline->stages[j].pid = -1;
+        }
+      }
+      for( j = 0 ; j < pipeline->count ; j++ ){
+        job->processes[j].pid = pipeline->stages[j].pid;
+        job->processes[j].status = W_EXITCODE( 127, 0 );
+        job->processes[j].state = PROCESS_DONE;
+        if ( job->processes[j].pid != -1 ){
+          job->processes[j].state = PROCESS_RUNNING;
+          job->running += 1;
+        }
+      }
+      if ( job->running > 0 ){
+        running += 1;
+      }
+      else if ( !keep_order ){
+        parallel_output( job );
+        printed += 1;
+      }
+    }
+
+    // In order, each job is shown once those before it have been
+    if ( keep_order ){
+      while( printed < next && jobs[printed].running == 0 ){
+        parallel_output( &jobs[printed++] );
+      }
+    }
+
+    if ( running == 0 ){
+      continue;
+    }
+
+    pid = waitpid( -1, &status, 0 );
+    if ( pid == -1 ){
+      if ( errno == EINTR ){
+        continue;
+      }
+      syserror( PARALLEL_WAIT_FAIL );
+    }
+
+    // A background job of the shell may have been reaped instead
+    job = NULL;
+    for( j = 0 ; j < next && job == NULL ; j++ ){
+      for( i = 0 ; i < jobs[j].count ; i++ ){
+        if ( jobs[j].running > 0 && jobs[j].processes[i].pid == pid ){
+          job_process_update( &jobs[j].processes[i], status );
+          job = &jobs[j];
+          break;
+        }
+      }
+    }
+    if ( job == NULL ){
+      jobs_record( pid, status );
+      continue;
+    }
+
+    // After a ^C the jobs not started yet are dropped
+    if ( WIFSIGNALED(status) && WTERMSIG(status) == SIGINT ){
+      total = next;
+    }
+
+    job->running -= 1;
+    if ( job->running == 0 ){
+      running -= 1;
+      if ( !keep_order ){
+        parallel_output( job );
+        printed += 1;
+      }
+    }
+  }
+
+  executor.job_table.job_control = job_control;
+
+  for( j = 0 ; j < total ; j++ ){
+    if ( job_exit_status( jobs[j].processes, jobs[j].count ) != 0 ){
+      failed += 1;
+    }
+  }
+  command_list_free( &list );
+
+  // Like GNU parallel, the number of jobs that failed
+  return failed < 101 ? failed : 101;
+}
+///////////////////////////////////////////////////////////////////////////////
+void parallel_output( struct parallel_job* job ){
+  // Copies everything a job wrote to the shell's stdout
+  char buffer[BUFFER_SIZE];
+  ssize_t length;
+  off_t offset = 0;
+
+  if ( job->output_fd == -1 ){
+    return;
+  }
+
+  // The kernel moves the bytes, falling back to read and write if it can't
+  fflush( stdout );
+  while( (length = sendfile( 1, job->output_fd, &offset, 1 << 20 )) != 0 ){
+    if ( length == -1 ){
+      if ( errno == EINTR ){
+        continue;
+      }
+      lseek( job->output_fd, offset, SEEK_SET );
+      while( (length = read( job->output_fd, buffer, BUFFER_SIZE )) > 0 ){
+        if ( write( 1, buffer, length ) == -1 ){
+          break;
+        }
+      }
+      break;
+    }
+  }
+
+  close( job->output_fd );
+  job->output_fd = -1;
+}
+///////////////////////////////////////////////////////////////////////////////
+int builtin_pcat( char* run_buffer_array[] ){
+  // Copies each file, or stdin, to stdout without reading it in
+  int fd, i, status = 0;
+
+  if ( run_buffer_array[1] == NULL ){
+    return plumb_copy( 0, 1 ) == -1;
+  }
+
+  for( i = 1 ; run_buffer_array[i] != NULL ; i++ ){
+    if ( strcmp( run_buffer_array[i], "-" ) == 0 ){
+      fd = 0;
+    }
+    else{
+      fd = open( run_buffer_array[i], O_RDONLY | O_CLOEXEC );
+      if ( fd == -1 ){
+        fprintf( stderr, PLUMB_FAIL, PCAT_STRING, run_buffer_array[i],
+          strerror(errno) );
+        status = 1;
+        continue;
+      }
+    }
+    if ( plumb_copy( fd, 1 ) == -1 ){
+      fprintf( stderr, PLUMB_FAIL, PCAT_STRING, run_buffer_array[i],
+        strerror(errno) );
+      status = 1;
+    }
+    if ( fd != 0 ){
+      close( fd );
+    }
+  }
+
+  return status;
+}
+///////////////////////////////////////////////////////////////////////////////
+int builtin_ptee( char* run_buffer_array[] ){
+  // Copies stdin to stdout and every file, duplicating it inside the kernel
+  struct stat info;
+  int* targets;
+  int scratch[2];
+  int flags, count, first, i, status = 0;
+  ssize_t length, teed;
+  bool live;
+
+  flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  first = 1;
+  if ( run_buffer_array[1] != NULL &&
+      strcmp( run_buffer_array[1], "-a" ) == 0 ){
+    flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+    first = 2;
+  }
+
+  // The files, then stdout last so it takes the data out of stdin
+  for( count = 0 ; run_buffer_array[first+count] != NULL ; count++ );
+  targets = (int *) malloc( (count + 1) * sizeof(int) );
+  if ( targets == NULL ){
+    syserror( OUT_OF_MEMORY );
+  }
+  for( i = 0 ; i < count ; i++ ){
+    targets[i] = open( run_buffer_array[first+i], flags, 0644 );
+    if ( targets[i] == -1 ){
+      fprintf( stderr, PLUMB_FAIL, PTEE_STRING, run_buffer_array[first+i],
+        strerror(errno) );
+      status = 1;
+    }
+  }
+  targets[count] = 1;
+
+  // tee only reads from a pipe, anything else is copied by hand
+  if ( fstat( 0, &info ) == -1 || !S_ISFIFO(info.st_mode) ||
+      plumb_scratch( scratch ) == -1 ){
+    status |= plumb_tee_copy( targets, count + 1 );
+  }
+  else{
+    while( 1 ){
+      // Duplicated into the scratch pipe for each file, then moved on. The
+      // first tee sets how much every target gets this time round.
+      live = false;
+      length = PLUMB_SIZE;
+      for( i = 0 ; i < count && length > 0 ; i++ ){
+        if ( targets[i] == -1 ){
+          continue;
+        }
+        do{
+          teed = tee( 0, scratch[1], length, 0 );
+        }while( teed == -1 && errno == EINTR );
+        length = teed;
+        live = true;
+        if ( length > 0 &&
+            plumb_move( scratch[0], targets[i], length ) == -1 ){
+          status = 1;
+          close( targets[i] );
+          targets[i] = -1;
+
+          // What the file did not take would go to the next one first, so
+          // the scratch pipe is replaced, or the other files given up
+          close( scratch[0] );
+          close( scratch[1] );
+          if ( plumb_scratch( scratch ) == -1 ){
+            for( i = 0 ; i < count ; i++ ){
+              if ( targets[i] != -1 ){
+                close( targets[i] );
+                targets[i] = -1;
+              }
+            }
+            scratch[0] = scratch[1] = -1;
+          }
+        }
+      }
+
+      // With no file left it is only a copy to stdout
+      if ( !live ){
+        status |= plumb_copy( 0, 1 ) == -1;
+        break;
+      }
+      if ( length <= 0 ){
+        status |= length == -1;
+        break;
+      }
+
+      // Finally stdout takes the data out of stdin
+      if ( plumb_move( 0, 1, length ) == -1 ){
+        status = 1;
+        break;
+      }
+    }
+    if ( scratch[0] != -1 ){
+      close( scratch[0] );
+      close( scratch[1] );
+    }
+  }
+
+  for( i = 0 ; i < count ; i++ ){
+    if ( targets[i] != -1 ){
+      close( targets[i] );
+    }
+  }
+  free( targets );
+
+  return status;
+}
+///////////////////////////////////////////////////////////////////////////////
+int plumb_copy( int in, int out ){
+  // Moves everything from in to out by the cheapest means the fds allow
+  struct stat in_info, out_info;
+  char buffer[READ_BLOCK_SIZE];
+  ssize_t length;
+  bool by_hand = false;
+
+  if ( fstat( in, &in_info ) == -1 || fstat( out, &out_info ) == -1 ){
+    return -1;
+  }
+
+  while( 1 ){
+    if ( by_hand ){
+      length = read( in, buffer, READ_BLOCK_SIZE );
+      if ( length > 0 && plumb_write( out, buffer, length ) == -1 ){
+        return -1;
+      }
+    }
+    else if ( S_ISREG(in_info.st_mode) ){
+      length = sendfile( out, in, NULL, PLUMB_SIZE );
+    }
+    else if ( S_ISFIFO(in_info.st_mode) || S_ISFIFO(out_info.st_mode) ){
+      length = splice( in, NULL, out, NULL, PLUMB_SIZE, SPLICE_F_MOVE );
+    }
+    else{
+      by_hand = true;
+      continue;
+    }
+
+    if ( length == 0 ){
+      return 0;
+    }
+    if ( length == -1 ){
+      if ( errno == EINTR ){
+        continue;
+      }
+      // Not every file, socket or terminal takes part
+      if ( !by_hand && (errno == EINVAL || errno == ENOSYS) ){
+        by_hand = true;
+        continue;
+      }
+      return -1;
+    }
+  }
+}
+///////////////////////////////////////////////////////////////////////////////
+int plumb_move( int in, int out, size_t length ){
+  // Moves exactly length bytes out of the pipe in
+  char buffer[READ_BLOCK_SIZE];
+  ssize_t moved;
+
+  while( length > 0 ){
+    moved = splice( in, NULL, out, NULL, length, SPLICE_F_MOVE );
+    if ( moved == -1 && (errno == EINVAL || errno == ENOSYS) ){
+      // An O_APPEND file on an older kernel, for one
+      moved = read( in, buffer,
+        length < READ_BLOCK_SIZE ? length : READ_BLOCK_SIZE );
+      if ( moved > 0 && plumb_write( out, buffer, moved ) == -1 ){
+        return -1;
+      }
+    }
+    if ( moved == -1 && errno == EINTR ){
+      continue;
+    }
+    if ( moved <= 0 ){
+      return -1;
+    }
+    length -= moved;
+  }
+
+  return 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+int plumb_scratch( int scratch[2] ){
+  // A pipe as big as stdin, so one tee fits in it
+  if ( pipe2( scratch, O_CLOEXEC ) == -1 ){
+    return -1;
+  }
+  if ( fcntl( scratch[1], F_SETPIPE_SZ, fcntl( 0, F_GETPIPE_SZ ) ) == -1 ){
+    close( scratch[0] );
+    close( scratch[1] );
+    return -1;
+  }
+
+  return 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+int plumb_tee_copy( int* targets, int count ){
+  // ptee through a buffer, when stdin is not a pipe
+  char buffer[READ_BLOCK_SIZE];
+  ssize_t length;
+  int i, status = 0;
+
+  while( (length = read( 0, buffer, READ_BLOCK_SIZE )) != 0 ){
+    if ( length == -1 ){
+      if ( errno == EINTR ){
+        continue;
+      }
+      return 1;
+    }
+    for( i = 0 ; i < count ; i++ ){
+      if ( targets[i] != -1 &&
+          plumb_write( targets[i], buffer, length ) == -1 ){
+        status = 1;
+      }
+    }
+  }
+
+  return status;
+}
+///////////////////////////////////////////////////////////////////////////////
+int plumb_write( int fd, const char* buffer, size_t length ){
+  // Writes all of buffer
+  ssize_t written;
+
+  while( length > 0 ){
+    written = write( fd, buffer, length );
+    if ( written == -1 ){
+      if ( errno == EINTR ){
+        continue;
+      }
+      return -1;
+    }
+    buffer += written;
+    length -= written;
+  }
+
+  return 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+void time_report( struct pipeline* pipeline, struct job_process* processes ){
+  // Prints where the time of a finished pipeline went, to stderr
+  struct job_process* process;
+  struct stage* stage;
+  struct timespec* end;
+  char maxrss[32];
+  double user = 0, system = 0;
+  int i;
+
+  // The last stage to be reaped ends the pipeline
+  end = &pipeline->spawned;
+
+  fprintf( stderr, TIME_HEADER );
+  for( i = 0 ; i < pipeline->count ; i++ ){
+    stage = &pipeline->stages[i];
+    process = &processes[i];
+    if ( process->pid == -1 ){
+      continue;
+    }
+    if ( time_elapsed( end, &process->end ) > 0 ){
+      end = &process->end;
+    }
+    user += time_seconds( &process->usage.ru_utime );
+    system += time_seconds( &process->usage.ru_stime );
+
+    // A peak of the shell's own says nothing about a builtin run in it
+    if ( process->pid == 0 ){
+      strcpy( maxrss, TIME_NO_MAXRSS );
+    }
+    else{
+      snprintf( maxrss, sizeof(maxrss), TIME_MAXRSS,
+        process->usage.ru_maxrss );
+    }
+    fprintf( stderr, TIME_STAGE, i + 1,
+      time_elapsed( &stage->start, &process->end ),
+      time_seconds( &process->usage.ru_utime ),
+      time_seconds( &process->usage.ru_stime ),
+      maxrss, process->usage.ru_nvcsw,
+      process->usage.ru_nivcsw, stage->run_buffer_array[0] );
+  }
+
+  // What the shell itself spent, before and while starting the stages
+  fprintf( stderr, TIME_SHELL, pipeline->parse_time,
+    time_elapsed( &pipeline->start, &pipeline->spawned ) );
+  fprintf( stderr, TIME_TOTAL,
+    time_elapsed( &pipeline->start, end ),
+    user, system );
+}
+///////////////////////////////////////////////////////////////////////////////
+double time_elapsed( const struct timespec* start,
+    const struct timespec* end ){
+  // Seconds between two clock_gettime calls
+  return (end->tv_sec - start->tv_sec) +
+    (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+///////////////////////////////////////////////////////////////////////////////
+double time_seconds( const struct timeval* time ){
+  // Seconds in an rusage time
+  return time->tv_sec + time->tv_usec / 1e6;
+}
+///////////////////////////////////////////////////////////////////////////////
+void rusage_subtract( struct rusage* usage, const struct rusage* before ){
+  // Turns two samples of the shell's usage into what was used between
+  timersub( &usage->ru_utime, &before->ru_utime, &usage->ru_utime );
+  timersub( &usage->ru_stime, &before->ru_stime, &usage->ru_stime );
+  usage->ru_nvcsw -= before->ru_nvcsw;
+  usage->ru_nivcsw -= before->ru_nivcsw;
+}
+///////////////////////////////////////////////////////////////////////////////
+void trace_open( void ){
+  // Points the trace at the fd or file named by TRACE_ENV
+  const char* target;
+  char* end;
+  long fd;
+
+  if ( executor.trace_fd != -1 ){
+    close( executor.trace_fd );
+    executor.trace_fd = -1;
+  }
+
+  target = variable_value( TRACE_ENV );
+  if ( target == NULL || target[0] == '\0' ){
+    return;
+  }
+
+  // A number is an fd the shell was started with, copied so a redirect
+  // of a builtin can not move it. Either way the children do not get it.
+  fd = strtol( target, &end, 10 );
+  if ( *end == '\0' && fd >= 0 ){
+    executor.trace_fd = fcntl( (int) fd, F_DUPFD_CLOEXEC, 10 );
+  }
+  else{
+    executor.trace_fd = open( target,
+      O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 );
+  }
+  if ( executor.trace_fd == -1 ){
+    fprintf( stderr, TRACE_OPEN_ERROR, target, strerror(errno) );
+  }
+}
+///////////////////////////////////////////////////////////////////////////////
+void trace_event( const char* event, pid_t child, const char* arg,
+    long value ){
+  // Writes one event as a line of JSON in a single write
+  char buffer[TRACE_BUFFER_SIZE];
+  struct timespec now;
+  size_t length, room;
+
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  length = snprintf( buffer, TRACE_BUFFER_SIZE, TRACE_HEAD,
+    (long) now.tv_sec, now.tv_nsec, (int) getpid(), event );
+  if ( child > 0 ){
+    length += snprintf( buffer + length, TRACE_BUFFER_SIZE - length,
+      TRACE_CHILD, (int) child );
+  }
+
+  // Escaped by hand, a long argument is cut short to leave room for the end
+  if ( arg != NULL ){
+    length += snprintf( buffer + length, TRACE_BUFFER_SIZE - length,
+      TRACE_ARG );
+    room = TRACE_BUFFER_SIZE - 64;
+    for( ; *arg != '\0' && length < room ; arg++ ){
+      if ( *arg == '"' || *arg == '\\' ){
+        buffer[length++] = '\\';
+        buffer[length++] = *arg;
+      }
+      else if ( (unsigned char) *arg < 0x20 ){
+        length += snprintf( buffer + length, TRACE_BUFFER_SIZE - length,
+          TRACE_ESCAPE, *arg );
+      }
+      else{
+        buffer[length++] = *arg;
+      }
+    }
+    buffer[length++] = '"';
+  }
+
+  length += snprintf( buffer + length, TRACE_BUFFER_SIZE - length,
+    TRACE_VALUE, value );
+
+  // O_APPEND keeps the lines of the shell and its children whole
+  if ( write( executor.trace_fd, buffer, length ) == -1 ){
+    return;
+  }
+}
+///////////////////////////////////////////////////////////////////////////////
+const struct builtin* builtin_lookup( const char* name ){
+  // Finds a builtin by name
+  int i;
+
+  for( i = 0 ; builtins[i].name != NULL ; i++ ){
+    if ( strcmp( builtins[i].name, name ) == 0 ){
+      return &builtins[i];
+    }
+  }
+
+  return NULL;
+}
+///////////////////////////////////////////////////////////////////////////////
+int builtin_cd( char* run_buffer_array[] ){
+  // Changes the directory of the shell itself
+  const char* dir;
+  char* cwd;
+
+  dir = run_buffer_array[1];
+  if ( dir == NULL ){
+    dir = variable_value( "HOME" );
+  }
+  else if ( strcmp( dir, "-" ) == 0 ){
+    dir = variable_value( "OLDPWD" );
+  }
+  if ( dir == NULL ){
+    fprintf( stderr, CD_NO_DIR );
+    return 1;
+  }
+
+  if ( chdir( dir ) == -1 ){
+    fprintf( stderr, CD_FAIL, dir, strerror(errno) );
+    return 1;
+  }
+
+  if ( variable_value( "PWD" ) != NULL ){
+    variable_set( "OLDPWD", 6, variable_value( "PWD" ), true );
+  }
+  cwd = getcwd( NULL, 0 );
+  if ( cwd != NULL ){
+    variable_set( "PWD", 3, cwd, true );
+    free( cwd );
+  }
+
+  return 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+int builtin_pwd( char* run_buffer_array[] ){
+  // Prints the current directory
+  char* cwd;
+
+  (void) run_buffer_array;
+
+  cwd = getcwd( NULL, 0 );
+  if ( cwd == NULL ){
+    fprintf( stderr, PWD_FAIL, strerror(errno) );
+    return 1;
+  }
+  printf( "%s\n", cwd );
+  free( cwd );
+
+  return 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+int builtin_echo( char* run_buffer_array[] ){
+  // Prints the arguments, -n leaves off the newline
+  bool newline = true;
+  int i = 1;
+
+  if ( run_buffer_array[1] != NULL && strcmp( run_buffer_array[1], "-n" ) == 0 ){
+    newline = false;
+    i = 2;
+  }
+
+  for( ; run_buffer_array[i] != NULL ; i++ ){
+    fputs( run_buffer_array[i], stdout );
+    if ( run_buffer_array[i+1] != NULL ){
+      putchar( ' ' );
+    }
+  }
+  if ( newline ){
+    putchar( '\n' );
+  }
+
+  return 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+int builtin_true( char* run_buffer_array[] ){
+  // Does nothing, successfully
+  (void) run_buffer_array;
+  return 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+int builtin_false( char* run_buffer_array[] ){
+  // Does nothing, unsuccessfully
+  (void) run_buffer_array;
+  return 1;
+}
+///////////////////////////////////////////////////////////////////////////////
+int builtin_exit( char* run_buffer_array[] ){
+  // Leaves the shell, or the child in a pipeline
+  fflush( stdout );
+  exit( run_buffer_array[1] != NULL ? atoi( run_buffer_array[1] ) :
+    executor.status );
+}
+///////////////////////////////////////////////////////////////////////////////
+int builtin_export( char* run_buffer_array[] ){
+  // Marks variables exported, setting them first when given a value
+  struct variable* variable;
+  char** envp;
+  const char* name;
+  size_t length;
+  int i, status;
+
+  if ( run_buffer_array[1] == NULL ){
+    envp = variables_envp();
+    for( i = 0 ; envp[i] != NULL ; i++ ){
+      printf( EXPORT_ENTRY, envp[i] );
+    }
+    return 0;
+  }
+
+  status = 0;
+  for( i = 1 ; run_buffer_array[i] != NULL ; i++ ){
+    name = run_buffer_array[i];
+    length = variable_name_length( name );
+    if ( length == 0 || (name[length] != '=' && name[length] != '\0') ){
+      fprintf( stderr, EXPORT_FAIL, name );
+      status = 1;
+      continue;
+    }
+
+    if ( name[length] == '=' ){
+      variable_assign( name, true );
+    }
+    else{
+      // Without a value only a variable already set is exported
+      variable = variable_find( name, length );
+      if ( variable == NULL || variable->exported ){
+        continue;
+      }
+      variable->exported = true;
+      free( executor.variables.envp );
+      executor.variables.envp = NULL;
+    }
+
+    if ( strncmp( name, TRACE_ENV, length ) == 0 &&
+        TRACE_ENV[length] == '\0' ){
+      // Tracing can be turned on or moved without restarting
+      trace_open();
+    }
+  }
+
+  return status;
+}
+///////////////////////////////////////////////////////////////////////////////
+int builtin_hash( char* run_buffer_array[] ){
+  // Runs the hash builtin
+  return command_hash_builtin( run_buffer_array );
+}
+///////////////////////////////////////////////////////////////////////////////
+int builtin_unset( char* run_buffer_array[] ){
+  // Removes each variable, which unexports it as well
+  int i;
+
+  for( i = 1 ; run_buffer_array[i] != NULL ; i++ ){
+    variable_unset( run_buffer_array[i] );
+    if ( strcmp( run_buffer_array[i], TRACE_ENV ) == 0 ){
+      trace_open();
+    }
+  }
+
+  return 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+struct pipeline* command_list_add_pipeline( struct command_list* list ){
+  // Appends an empty pipeline, reusing the one left in the slot
+  struct pipeline* pipeline;
+
+  if ( list->count == list->capacity ){
+    list->capacity = list->capacity ? list->capacity * 2 : 4;
+    list->pipelines = (struct pipeline *) realloc( list->pipelines,
+      list->capacity * sizeof(struct pipeline) );
+    if ( list->pipelines == NULL ){
+      syserror( OUT_OF_MEMORY );
+    }
+    memset( list->pipelines + list->count, 0,
+      (list->capacity - list->count) * sizeof(struct pipeline) );
+  }
+
+  pipeline = &list->pipelines[list->count++];
+  pipeline->count = 0;
+  pipeline->background = false;
+  pipeline->run_if = RUN_ALWAYS;
+  pipeline->pgid = 0;
+  pipeline->out_fd = 1;
+  pipeline->timed = false;
+  pipeline->pipe_size = 0;
+
+  return pipeline;
+}
+///////////////////////////////////////////////////////////////////////////////
+void command_list_clear( struct command_list* list ){
+  // Drops every pipeline at once, keeping the arrays and arena for reuse
+  list->count = 0;
+  arena_reset( &list->arena );
+}
+///////////////////////////////////////////////////////////////////////////////
+void command_list_free( struct command_list* list ){
+  // Gives back everything the list has grown, stage arrays included
+  int i;
+
+  for( i = 0 ; i < list->capacity ; i++ ){
+    free( list->pipelines[i].stages );
+  }
+  free( list->pipelines );
+  arena_free( &list->arena );
+  memset( list, 0, sizeof(struct command_list) );
+}
+///////////////////////////////////////////////////////////////////////////////
+struct stage* pipeline_add_stage( struct pipeline* pipeline,
+    struct arena* arena ){
+  // Appends an empty stage, doubling the stage array when it is full
+
+  struct stage* stage;
+
+  if ( pipeline->count == pipeline->capacity ){
+    pipeline->capacity = pipeline->capacity ? pipeline->capacity * 2 : 4;
+    pipeline->stages = (struct stage *) realloc( pipeline->stages,
+      pipeline->capacity * sizeof(struct stage) );
+    if ( pipeline->stages == NULL ){
+      syserror( OUT_OF_MEMORY );
+    }
+  }
+
+  stage = &pipeline->stages[pipeline->count++];
+  stage->run_buffer_array = (char **) arena_alloc( arena,
+    ARG_COUNT * sizeof(char *) );
+  null_run_array( stage->run_buffer_array, ARG_COUNT );
+  stage->args_capacity = ARG_COUNT;
+  stage->args_size = 0;
+  stage->assignments = NULL;
+  stage->assignment_count = stage->assignment_capacity = 0;
+  stage->envp = NULL;
+  stage->redirects = NULL;
+  stage->redirect_count = stage->redirect_capacity = 0;
+  stage->args_count = 0;
+  stage->fd[0] = 0;
+  stage->fd[1] = 1;
+  stage->pid = -1;
+
+  return stage;
+}
+///////////////////////////////////////////////////////////////////////////////
+bool stage_empty( struct stage* stage ){
+  // True if nothing has been parsed into the stage
+  return stage->run_buffer_array[0] == NULL && stage->redirect_count == 0 &&
+    stage->assignment_count == 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+int pipeline_close_fds( struct pipeline* pipeline ){
+  // Closes every pipe end held by the stages
+  int i, status;
+
+  status = 0;
+  for( i = 0 ; i < pipeline->count ; i++ ){
+    if ( pipeline->stages[i].fd[0] != 0 &&
+        close( pipeline->stages[i].fd[0] ) == -1 ){
+      status = -1;
+    }
+    if ( pipeline->stages[i].fd[1] != 1 &&
+        pipeline->stages[i].fd[1] != pipeline->out_fd &&
+        close( pipeline->stages[i].fd[1] ) == -1 ){
+      status = -1;
+    }
+  }
+
+  return status;
+}
+///////////////////////////////////////////////////////////////////////////////
+void syserror(const char *s){
+  // System error call
+  extern int errno;
+
+  fprintf( stderr, "%s\n", s );
+  fprintf( stderr, " (%s)\n", strerror(errno) );
+  exit( 1 );
+}
+///////////////////////////////////////////////////////////////////////////////
+void pipeline_expand( struct pipeline* pipeline, struct arena* arena ){
+  // Expands the words of each stage in place of the parsed ones
+  struct glob_list words;
+  struct stage* stage;
+  char** assignments;
+  char* word;
+  char* field;
+  char* end;
+  unsigned int i, j, count;
+  int k;
+
+  for( k = 0 ; k < pipeline->count ; k++ ){
+    stage = &pipeline->stages[k];
+
+    for( j = 0 ; j < stage->redirect_count ; j++ ){
+      word = stage->redirects[j].file;
+      if ( word != NULL &&
+          stage->redirects[j].type != REDIRECT_PROCESS_IN &&
+          stage->redirects[j].type != REDIRECT_PROCESS_OUT ){
+        word = word_expand( word, arena, false );
+        stage->redirects[j].file = glob_literal( word,
+          word + strlen( word ), arena );
+      }
+    }
+
+    // The cached assignments are only read, the expanded ones are copies
+    if ( stage->assignment_count > 0 ){
+      assignments = (char **) arena_alloc( arena,
+        stage->assignment_count * sizeof(char *) );
+      for( j = 0 ; j < stage->assignment_count ; j++ ){
+        word = word_expand( stage->assignments[j], arena, false );
+        assignments[j] = glob_literal( word, word + strlen( word ), arena );
+      }
+      stage->assignments = assignments;
+      stage->assignment_capacity = stage->assignment_count;
+    }
+
+    // Most stages have nothing to expand and keep the argv they have
+    for( i = 0 ; stage->run_buffer_array[i] != NULL ; i++ ){
+      if ( strpbrk( stage->run_buffer_array[i], EXPAND_MARKS ) != NULL ){
+        break;
+      }
+    }
+    if ( stage->run_buffer_array[i] != NULL ){
+      words.words = (char **) arena_alloc( arena,
+        stage->args_capacity * sizeof(char *) );
+      words.capacity = stage->args_capacity;
+      words.count = i;
+      words.arena = arena;
+      memcpy( words.words, stage->run_buffer_array, i * sizeof(char *) );
+
+      for( ; stage->run_buffer_array[i] != NULL ; i++ ){
+        word = word_expand( stage->run_buffer_array[i], arena, true );
+        count = words.count;
+
+        // Each field is globbed alone, an empty one is dropped
+        for( field = word ; field != NULL ; field = end ){
+          end = word != stage->run_buffer_array[i] ?
+            strchr( field, FIELD_MARK ) : NULL;
+          if ( end != NULL ){
+            *end++ = '\0';
+          }
+          if ( field[0] == '\0' ){
+            continue;
+          }
+          if ( !glob_magic( field, field + strlen( field ) ) ||
+              glob_expand( field, &words ) == 0 ){
+            glob_list_add( &words, glob_literal( field,
+              field + strlen( field ), arena ) );
+          }
+        }
+
+        // Unless it was quoted, or was empty as typed. The first field
+        // is empty, so the word is as well.
+        if ( words.count == count &&
+            (strchr( stage->run_buffer_array[i], EXPAND_MARK ) == NULL ||
+            strchr( stage->run_buffer_array[i], EXPAND_QUOTED ) != NULL) ){
+          glob_list_add( &words, word );
+        }
+      }
+      glob_list_add( &words, NULL );
+
+      stage->run_buffer_array = words.words;
+      stage->args_capacity = words.capacity;
+      stage->args_count = words.count > 2 ? words.count - 2 : 0;
+      stage->args_size = 0;
+      for( i = 0 ; words.words[i] != NULL ; i++ ){
+        stage->args_size += strlen( words.words[i] ) + 1 + sizeof(char *);
+      }
+    }
+
+    stage->envp = stage->run_buffer_array[0] != NULL &&
+      stage->assignment_count > 0 ? stage_envp( stage, arena ) : NULL;
+  }
+}
+///////////////////////////////////////////////////////////////////////////////
+char* word_expand( char* word, struct arena* arena, bool split ){
+  // Copies the word with each $ it holds replaced, sized first
+  char number[24];
+  const char* value;
+  const char* after;
+  const char* p;
+  char* expanded;
+  size_t length;
+  bool fields;
+
+  if ( strchr( word, EXPAND_MARK ) == NULL &&
+      strchr( word, EXPAND_QUOTED ) == NULL ){
+    return word;
+  }
+
+  length = 0;
+  for( p = word ; *p != '\0' ; ){
+    if ( (*p == EXPAND_MARK || *p == EXPAND_QUOTED) &&
+        (value = word_variable( p, &after, number )) != NULL ){
+      length += strlen( value );
+      p = after;
+    }
+    else{
+      length += 1;
+      p += 1;
+    }
+  }
+
+  expanded = (char *) arena_alloc( arena, length + 1 );
+  length = 0;
+  for( p = word ; *p != '\0' ; ){
+    if ( *p != EXPAND_MARK && *p != EXPAND_QUOTED ){
+      expanded[length++] = *p++;
+      continue;
+    }
+
+    fields = split && *p == EXPAND_MARK;
+    value = word_variable( p, &after, number );
+    if ( value == NULL ){
+      expanded[length++] = '$';
+      p += 1;
+      continue;
+    }
+    for( ; *value != '\0' ; value++ ){
+      expanded[length++] = fields && (*value == ' ' || *value == '\t' ||
+        *value == '\n') ? FIELD_MARK : *value;
+    }
+    p = after;
+  }
+  expanded[length] = '\0';
+
+  return expanded;
+}
+///////////////////////////////////////////////////////////////////////////////
+const char* word_variable( const char* mark, const char** after,
+    char number[24] ){
+  // Reads $?, $$, $NAME or ${NAME}
+  struct variable* variable;
+  const char* name;
+  size_t length;
+
+  if ( mark[1] == '?' ){
+    snprintf( number, 24, "%d", executor.status );
+    *after = mark + 2;
+    return number;
+  }
+  // The second $ was marked as well
+  if ( mark[1] == EXPAND_MARK || mark[1] == EXPAND_QUOTED ){
+    snprintf( number, 24, "%d", (int) getpid() );
+    *after = mark + 2;
+    return number;
+  }
+
+  if ( mark[1] == '{' ){
+    name = mark + 2;
+    length = variable_name_length( name );
+    if ( length == 0 || name[length] != '}' ){
+      return NULL;
+    }
+    *after = name + length + 1;
+  }
+  else{
+    name = mark + 1;
+    length = variable_name_length( name );
+    if ( length == 0 ){
+      return NULL;
+    }
+    *after = name + length;
+  }
+
+  variable = variable_find( name, length );
+  return variable != NULL ? variable->entry + length + 1 : "";
+}
+///////////////////////////////////////////////////////////////////////////////
+struct variable* variable_find( const char* name, size_t length ){
+  // Searches the bucket, filling the table from environ the first time
+  struct variable_table* table = &executor.variables;
+  struct variable* variable;
+  const char* equals;
+  size_t i;
+
+  if ( !table->loaded ){
+    table->loaded = true;
+    for( i = 0 ; environ[i] != NULL ; i++ ){
+      equals = strchr( environ[i], '=' );
+      if ( equals == NULL || variable_find( environ[i],
+          equals - environ[i] ) != NULL ){
+        continue;
+      }
+      variable_set( environ[i], equals - environ[i], equals + 1, true );
+    }
+  }
+
+  variable = table->buckets[variable_bucket( name, length )];
+  for( ; variable != NULL ; variable = variable->next ){
+    if ( variable->name_length == length &&
+        memcmp( variable->entry, name, length ) == 0 ){
+      return variable;
+    }
+  }
+
+  return NULL;
+}
+///////////////////////////////////////////////////////////////////////////////
+const char* variable_value( const char* name ){
+  // Finds the value after the =
+  struct variable* variable;
+
+  variable = variable_find( name, strlen( name ) );
+  return variable != NULL ? variable->entry + variable->name_length + 1 :
+    NULL;
+}
+///////////////////////////////////////////////////////////////////////////////
+void variable_set( const char* name, size_t length, const char* value,
+    bool exported ){
+  // Replaces the entry, made before the old one is freed as value may be
+  // part of it
+  struct variable_table* table = &executor.variables;
+  struct variable* variable;
+  unsigned int bucket;
+  char* entry;
+
+  entry = (char *) malloc( length + strlen( value ) + 2 );
+  if ( entry == NULL ){
+    syserror( OUT_OF_MEMORY );
+  }
+  memcpy( entry, name, length );
+  entry[length] = '=';
+  strcpy( entry + length + 1, value );
+
+  variable = variable_find( name, length );
+  if ( variable == NULL ){
+    variable = (struct variable *) malloc( sizeof(struct variable) );
+    if ( variable == NULL ){
+      syserror( OUT_OF_MEMORY );
+    }
+    bucket = variable_bucket( name, length );
+    variable->entry = entry;
+    variable->name_length = length;
+    variable->exported = false;
+    variable->next = table->buckets[bucket];
+    table->buckets[bucket] = variable;
+  }
+  else{
+    free( variable->entry );
+    variable->entry = entry;
+  }
+
+  if ( exported || variable->exported ){
+    variable->exported = true;
+    free( table->envp );
+    table->envp = NULL;
+  }
+}
+///////////////////////////////////////////////////////////////////////////////
+void variable_assign( const char* assignment, bool exported ){
+  // Splits the word at its =
+  size_t length = variable_name_length( assignment );
+
+  variable_set( assignment, length, assignment + length + 1, exported );
+}
+///////////////////////////////////////////////////////////////////////////////
+void variable_unset( const char* name ){
+  // Unlinks the variable from its bucket
+  struct variable_table* table = &executor.variables;
+  struct variable** link;
+  struct variable* variable;
+  size_t length;
+
+  length = strlen( name );
+  if ( variable_find( name, length ) == NULL ){
+    return;
+  }
+
+  link = &table->buckets[variable_bucket( name, length )];
+  while( (variable = *link) != NULL ){
+    if ( variable->name_length == length &&
+        memcmp( variable->entry, name, length ) == 0 ){
+      *link = variable->next;
+      if ( variable->exported ){
+        free( table->envp );
+        table->envp = NULL;
+      }
+      free( variable->entry );
+      free( variable );
+      return;
+    }
+    link = &variable->next;
+  }
+}
+///////////////////////////////////////////////////////////////////////////////
+size_t variable_name_length( const char* word ){
+  // Letters, digits and _, not starting with a digit
+  size_t length = 0;
+
+  if ( !isalpha( (unsigned char) word[0] ) && word[0] != '_' ){
+    return 0;
+  }
+  while( isalnum( (unsigned char) word[length] ) || word[length] == '_' ){
+    length++;
+  }
+
+  return length;
+}
+///////////////////////////////////////////////////////////////////////////////
+unsigned int variable_bucket( const char* name, size_t length ){
+  // FNV-1a over the name
+  unsigned int hash = 2166136261u;
+
+  while( length-- > 0 ){
+    hash = (hash ^ (unsigned char) *name++) * 16777619u;
+  }
+
+  return hash % HASH_SIZE;
+}
+///////////////////////////////////////////////////////////////////////////////
+char** variables_envp( void ){
+  // Gathers the exported entries when the last envp has been dropped
+  struct variable_table* table = &executor.variables;
+  struct variable* variable;
+  size_t count;
+  int i;
+
+  // Reads environ in
+  if ( !table->loaded ){
+    variable_find( "", 0 );
+  }
+  if ( table->envp != NULL ){
+    return table->envp;
+  }
+
+  count = 0;
+  for( i = 0 ; i < HASH_SIZE ; i++ ){
+    for( variable = table->buckets[i] ; variable ; variable = variable->next ){
+      count += variable->exported;
+    }
+  }
+
+  table->envp = (char **) malloc( (count + 1) * sizeof(char *) );
+  if ( table->envp == NULL ){
+    syserror( OUT_OF_MEMORY );
+  }
+  table->exported = 0;
+  for( i = 0 ; i < HASH_SIZE ; i++ ){
+    for( variable = table->buckets[i] ; variable ; variable = variable->next ){
+      if ( variable->exported ){
+        table->envp[table->exported++] = variable->entry;
+      }
+    }
+  }
+  table->envp[table->exported] = NULL;
+  trace( TRACE_ENVP, 0, NULL, table->exported );
+
+  return table->envp;
+}
+///////////////////////////////////////////////////////////////////////////////
+char** stage_envp( struct stage* stage, struct arena* arena ){
+  // Copies the shell's envp and lays the assignments over it
+  char** shell;
+  char** envp;
+  size_t count, length, i, j;
+
+  shell = variables_envp();
+  count = executor.variables.exported;
+  envp = (char **) arena_alloc( arena,
+    (count + stage->assignment_count + 1) * sizeof(char *) );
+  memcpy( envp, shell, count * sizeof(char *) );
+
+  for( i = 0 ; i < stage->assignment_count ; i++ ){
+    length = variable_name_length( stage->assignments[i] ) + 1;
+    for( j = 0 ; j < count ; j++ ){
+      if ( strncmp( envp[j], stage->assignments[i], length ) == 0 ){
+        break;
+      }
+    }
+    envp[j] = stage->assignments[i];
+    count += j == count;
+  }
+  envp[count] = NULL;
+
+  return envp;
+}
+///////////////////////////////////////////////////////////////////////////////
+size_t glob_expand( const char* pattern, struct glob_list* matches ){
+  // Collects the paths matching a pattern in sorted order
+  struct glob_dir* dir;
+  size_t first = matches->count;
+
+  // Only emptied between globs, as a walk holds listings while it recurses
+  if ( executor.glob_cache.count >= GLOB_CACHE_DIRS ){
+    glob_cache_clear();
+  }
+  while( (dir = executor.glob_cache.retired) != NULL ){
+    executor.glob_cache.retired = dir->next;
+    glob_dir_free( dir );
+  }
+
+  if ( pattern[0] == '/' ){
+    glob_walk( matches, "/", pattern + 1 );
+  }
+  else{
+    glob_walk( matches, "", pattern );
+  }
+
+  qsort( matches->words + first, matches->count - first, sizeof(char *),
+    glob_compare );
+  return matches->count - first;
+}
+///////////////////////////////////////////////////////////////////////////////
+void glob_walk( struct glob_list* matches, const char* prefix,
+    const char* pattern ){
+  // Matches one component and recurses into the rest
+  struct glob_dir* dir;
+  struct stat info;
+  const char* end;
+  const char* next;
+  char* literal;
+  char* path;
+  size_t prefix_length, i;
+  unsigned char type;
+
+  end = strchr( pattern, '/' );
+  next = end != NULL ? end + 1 : NULL;
+  if ( end == NULL ){
+    end = pattern + strlen( pattern );
+  }
+  prefix_length = strlen( prefix );
+
+  // A component with nothing to match is only added to the path, and the
+  // whole path checked once it is complete
+  if ( !glob_magic( pattern, end ) ){
+    literal = glob_literal( pattern, end, matches->arena );
+    path = (char *) arena_alloc( matches->arena,
+      prefix_length + strlen( literal ) + 2 );
+    strcpy( stpcpy( stpcpy( path, prefix ), literal ), next ? "/" : "" );
+    if ( next != NULL ){
+      glob_walk( matches, path, next );
+    }
+    else if ( lstat( path, &info ) == 0 ){
+      glob_list_add( matches, path );
+    }
+    return;
+  }
+
+  dir = glob_dir_read( prefix_length ? prefix : "." );
+  if ( dir == NULL ){
+    return;
+  }
+
+  // ** is no directory at all, or any directory below
+  if ( next != NULL && end - pattern == 2 &&
+      pattern[0] == GLOB_STAR && pattern[1] == GLOB_STAR ){
+    glob_walk( matches, prefix, next );
+    for( i = 0 ; i < dir->count ; i++ ){
+      if ( dir->names[i][0] == '.' ){
+        continue;
+      }
+      path = (char *) arena_alloc( matches->arena,
+        prefix_length + strlen( dir->names[i] ) + 2 );
+      strcpy( stpcpy( stpcpy( path, prefix ), dir->names[i] ), "/" );
+      type = dir->names[i][-1];
+      if ( type == DT_DIR || (type == DT_UNKNOWN &&
+          lstat( path, &info ) == 0 && S_ISDIR(info.st_mode)) ){
+        glob_walk( matches, path, pattern );
+      }
+    }
+    return;
+  }
+
+  for( i = 0 ; i < dir->count ; i++ ){
+    // Hidden names are only matched by a leading .
+    if ( dir->names[i][0] == '.' && pattern[0] != '.' ){
+      continue;
+    }
+    if ( !glob_match( pattern, end, dir->names[i] ) ){
+      continue;
+    }
+
+    path = (char *) arena_alloc( matches->arena,
+      prefix_length + strlen( dir->names[i] ) + 2 );
+    strcpy( stpcpy( stpcpy( path, prefix ), dir->names[i] ),
+      next ? "/" : "" );
+    if ( next != NULL ){
+      glob_walk( matches, path, next );
+    }
+    else{
+      glob_list_add( matches, path );
+    }
+  }
+}
+///////////////////////////////////////////////////////////////////////////////
+struct glob_dir* glob_dir_read( const char* path ){
+  // Looks the directory up by its inode, listing it on a miss
+  struct glob_cache* cache = &executor.glob_cache;
+  struct glob_dir* dir;
+  struct glob_dir** link;
+  struct dirent* entry;
+  struct timespec now;
+  struct stat info;
+  size_t* offsets;
+  size_t length, used, size, capacity, i;
+  unsigned int bucket;
+  DIR* stream;
+
+  if ( stat( path, &info ) == -1 || !S_ISDIR(info.st_mode) ){
+    return NULL;
+  }
+
+  bucket = info.st_ino % GLOB_CACHE_SIZE;
+  for( link = &cache->buckets[bucket] ; *link ; link = &(*link)->next ){
+    dir = *link;
+    if ( dir->dev != info.st_dev || dir->ino != info.st_ino ){
+      continue;
+    }
+    if ( dir->trusted && dir->mtime.tv_sec == info.st_mtim.tv_sec &&
+        dir->mtime.tv_nsec == info.st_mtim.tv_nsec ){
+      return dir;
+    }
+
+    // Changed, or too new to tell. It is kept until the glob is over.
+    *link = dir->next;
+    dir->next = cache->retired;
+    cache->retired = dir;
+    cache->count -= 1;
+    break;
+  }
+
+  // Taken first, so a change during the scan makes the listing untrusted
+  clock_gettime( CLOCK_REALTIME, &now );
+  stream = opendir( path );
+  if ( stream == NULL ){
+    return NULL;
+  }
+
+  dir = (struct glob_dir *) calloc( 1, sizeof(struct glob_dir) );
+  if ( dir == NULL ){
+    syserror( OUT_OF_MEMORY );
+  }
+  dir->dev = info.st_dev;
+  dir->ino = info.st_ino;
+  dir->mtime = info.st_mtim;
+  dir->trusted = now.tv_sec - info.st_mtim.tv_sec > 1;
+
+  // Each name goes in strings after its d_type, and is pointed at once
+  // strings has stopped moving
+  offsets = NULL;
+  used = size = capacity = 0;
+  while( (entry = readdir( stream )) != NULL ){
+    if ( strcmp( entry->d_name, "." ) == 0 ||
+        strcmp( entry->d_name, ".." ) == 0 ){
+      continue;
+    }
+    length = strlen( entry->d_name ) + 1;
+    if ( used + length + 1 > size ){
+      size = 2 * (used + length) + 256;
+      dir->strings = (char *) realloc( dir->strings, size );
+    }
+    if ( dir->count == capacity ){
+      capacity = capacity ? 2 * capacity : 64;
+      offsets = (size_t *) realloc( offsets, capacity * sizeof(size_t) );
+    }
+    if ( dir->strings == NULL || offsets == NULL ){
+      syserror( OUT_OF_MEMORY );
+    }
+    dir->strings[used] = entry->d_type;
+    memcpy( dir->strings + used + 1, entry->d_name, length );
+    offsets[dir->count++] = used + 1;
+    used += length + 1;
+  }
+  closedir( stream );
+  trace( TRACE_READDIR, 0, path, dir->count );
+
+  dir->names = (char **) malloc( (dir->count + 1) * sizeof(char *) );
+  if ( dir->names == NULL ){
+    syserror( OUT_OF_MEMORY );
+  }
+  for( i = 0 ; i < dir->count ; i++ ){
+    dir->names[i] = dir->strings + offsets[i];
+  }
+  free( offsets );
+
+  // Sorted once here, so a glob's matches come out nearly in order
+  qsort( dir->names, dir->count, sizeof(char *), glob_compare );
+
+  dir->next = cache->buckets[bucket];
+  cache->buckets[bucket] = dir;
+  cache->count += 1;
+
+  return dir;
+}
+///////////////////////////////////////////////////////////////////////////////
+void glob_dir_free( struct glob_dir* dir ){
+  // Frees a listing and its names
+  free( dir->names );
+  free( dir->strings );
+  free( dir );
+}
+///////////////////////////////////////////////////////////////////////////////
+void glob_cache_clear( void ){
+  // Empties the glob cache
+  struct glob_dir* dir;
+  int i;
+
+  for( i = 0 ; i < GLOB_CACHE_SIZE ; i++ ){
+    while( (dir = executor.glob_cache.buckets[i]) != NULL ){
+      executor.glob_cache.buckets[i] = dir->next;
+      glob_dir_free( dir );
+    }
+  }
+  executor.glob_cache.count = 0;
+}
+///////////////////////////////////////////////////////////////////////////////
+bool glob_match( const char* pattern, const char* end, const char* name ){
+  // Matches a component, going back to the last * on a mismatch
+  const char* star = NULL;
+  const char* retry = NULL;
+  const char* after;
+  bool match;
+
+  while( *name != '\0' ){
+    if ( pattern < end && *pattern == GLOB_STAR ){
+      star = ++pattern;
+      retry = name;
+      continue;
+    }
+    if ( pattern < end ){
+      if ( *pattern == GLOB_ONE ){
+        pattern++;
+        name++;
+        continue;
+      }
+      if ( *pattern == GLOB_OPEN &&
+          (after = glob_class( pattern + 1, end, *name, &match )) != NULL ){
+        if ( match ){
+          pattern = after;
+          name++;
+          continue;
+        }
+      }
+      else if ( *pattern == *name ||
+          (*pattern == GLOB_OPEN && *name == '[') ){
+        pattern++;
+        name++;
+        continue;
+      }
+    }
+
+    // Let the last * take one more character
+    if ( star == NULL ){
+      return false;
+    }
+    pattern = star;
+    name = ++retry;
+  }
+
+  while( pattern < end && *pattern == GLOB_STAR ){
+    pattern++;
+  }
+  return pattern == end;
+}
+///////////////////////////////////////////////////////////////////////////////
+const char* glob_class( const char* pattern, const char* end, char c,
+    bool* match ){
+  // Tests a character against a bracket class
+  bool negate = false;
+  char low, high;
+
+  *match = false;
+  if ( pattern < end && (*pattern == '!' || *pattern == '^') ){
+    negate = true;
+    pattern++;
+  }
+
+  // A ] first is part of the class
+  if ( pattern < end && *pattern == ']' ){
+    *match = c == ']';
+    pattern++;
+  }
+
+  while( pattern < end && *pattern != ']' ){
+    low = glob_char( *pattern++ );
+    high = low;
+    if ( pattern + 1 < end && *pattern == '-' && pattern[1] != ']' ){
+      high = glob_char( pattern[1] );
+      pattern += 2;
+    }
+    if ( c >= low && c <= high ){
+      *match = true;
+    }
+  }
+  if ( pattern == end ){
+    return NULL;
+  }
+
+  *match = *match != negate;
+  return pattern + 1;
+}
+///////////////////////////////////////////////////////////////////////////////
+char glob_char( char c ){
+  // The character typed for a mark
+  switch( c ){
+    case GLOB_STAR:
+      return '*';
+    case GLOB_ONE:
+      return '?';
+    case GLOB_OPEN:
+      return '[';
+    case EXPAND_MARK:
+    case EXPAND_QUOTED:
+      return '$';
+  }
+  return c;
+}
+///////////////////////////////////////////////////////////////////////////////
+bool glob_magic( const char* pattern, const char* end ){
+  // True if anything in the pattern matches more than itself
+  bool match;
+
+  for( ; pattern < end ; pattern++ ){
+    if ( *pattern == GLOB_STAR || *pattern == GLOB_ONE ||
+        (*pattern == GLOB_OPEN &&
+          glob_class( pattern + 1, end, '\0', &match ) != NULL) ){
+      return true;
+    }
+  }
+
+  return false;
+}
+///////////////////////////////////////////////////////////////////////////////
+char* glob_literal( const char* word, const char* end, struct arena* arena ){
+  // Copies the word with its marks made characters again
+  char* copy;
+  size_t i;
+
+  if ( *end == '\0' && strpbrk( word, EXPAND_MARKS ) == NULL ){
+    return (char *) word;
+  }
+
+  copy = (char *) arena_alloc( arena, end - word + 1 );
+  for( i = 0 ; word + i < end ; i++ ){
+    copy[i] = glob_char( word[i] );
+  }
+  copy[i] = '\0';
+
+  return copy;
+}
+///////////////////////////////////////////////////////////////////////////////
+void glob_list_add( struct glob_list* list, char* word ){
+  // Appends to the list, growing it in the arena
+  char** words;
+
+  if ( list->count == list->capacity ){
+    list->capacity = list->capacity ? 2 * list->capacity : ARG_COUNT;
+    words = (char **) arena_alloc( list->arena,
+      list->capacity * sizeof(char *) );
+    memcpy( words, list->words, list->count * sizeof(char *) );
+    list->words = words;
+  }
+
+  list->words[list->count++] = word;
+}
+///////////////////////////////////////////////////////////////////////////////
+int glob_compare( const void* a, const void* b ){
+  // Orders two strings for qsort
+  return strcmp( *(char * const *) a, *(char * const *) b );
+}
+///////////////////////////////////////////////////////////////////////////////
+void command_out( char* word, bool *is_command, struct stage* stage,
+    struct arena* arena ){
+  // Adds the word into the cmd array
+  char** run_buffer_array;
+
+  if ( *is_command ){
+    stage->args_count = 0;
+    *is_command = false;
+  }
+  else{
+    stage->args_count+=1;
+  }
+
+  // Leave room for the word and the null that ends argv
+  if ( stage->args_count + 1 >= stage->args_capacity ){
+    run_buffer_array = (char **) arena_alloc( arena,
+      2 * stage->args_capacity * sizeof(char *) );
+    memcpy( run_buffer_array, stage->run_buffer_array,
+      stage->args_capacity * sizeof(char *) );
+    null_run_array( run_buffer_array + stage->args_capacity,
+      stage->args_capacity );
+    stage->run_buffer_array = run_buffer_array;
+    stage->args_capacity *= 2;
+  }
+
+  stage->run_buffer_array[stage->args_count] = word;
+  stage->args_size += strlen( word ) + 1 + sizeof(char *);
+}
+///////////////////////////////////////////////////////////////////////////////
+void stage_add_assignment( struct stage* stage, char* word,
+    struct arena* arena ){
+  // Appends an assignment, in the order they are written
+  char** assignments;
+
+  if ( stage->assignment_count == stage->assignment_capacity ){
+    stage->assignment_capacity = stage->assignment_capacity ?
+      2 * stage->assignment_capacity : ARG_COUNT;
+    assignments = (char **) arena_alloc( arena,
+      stage->assignment_capacity * sizeof(char *) );
+    if ( stage->assignment_count > 0 ){
+      memcpy( assignments, stage->assignments,
+        stage->assignment_count * sizeof(char *) );
+    }
+    stage->assignments = assignments;
+  }
+
+  stage->assignments[stage->assignment_count++] = word;
+}
+///////////////////////////////////////////////////////////////////////////////
+struct redirect* stage_add_redirect( struct stage* stage,
+    struct arena* arena ){
+  // Appends a redirect, in the order they are applied
+  struct redirect* redirects;
+  struct redirect* redirect;
+
+  if ( stage->redirect_count == stage->redirect_capacity ){
+    stage->redirect_capacity = stage->redirect_capacity ?
+      2 * stage->redirect_capacity : REDIRECT_COUNT;
+    redirects = (struct redirect *) arena_alloc( arena,
+      stage->redirect_capacity * sizeof(struct redirect) );
+    if ( stage->redirect_count > 0 ){
+      memcpy( redirects, stage->redirects,
+        stage->redirect_count * sizeof(struct redirect) );
+    }
+    stage->redirects = redirects;
+  }
+
+  redirect = &stage->redirects[stage->redirect_count++];
+  redirect->open_fd = redirect->saved_fd = -1;
+
+  return redirect;
+}
+///////////////////////////////////////////////////////////////////////////////
+void tokenizer_start( struct tokenizer* tokenizer, char* input_buffer ){
+  // Points the tokenizer at the start of a new line
+  tokenizer->input_buffer = input_buffer;
+  tokenizer->current_pos = 0;
+  tokenizer->held = '\0';
+  tokenizer->quiet = false;
+  tokenizer->strip_tabs = false;
+  tokenizer->quoted = false;
+}
+///////////////////////////////////////////////////////////////////////////////
+char tokenizer_peek( struct tokenizer* tokenizer ){
+  // Returns the character under the cursor, even if a null covers it
+  if ( tokenizer->held ){
+    return tokenizer->held;
+  }
+  return tokenizer->input_buffer[tokenizer->current_pos];
+}
+///////////////////////////////////////////////////////////////////////////////
+enum token_type next_token( struct tokenizer* tokenizer, char** word ){
+  // Cuts the next token out of the line, terminating words in place
+
+  char* input_buffer = tokenizer->input_buffer;
+  char current_char;
+  int current_pos, write_pos, word_start, fd;
+
+  current_char = remove_whitespace( tokenizer );
+
+  switch( current_char ){
+    case '\0':
+    case '\n':
+      return TOKEN_END;
+    case '|':
+      tokenizer->held = '\0';
+      tokenizer->current_pos += 1;
+      if ( input_buffer[tokenizer->current_pos] == '|' ){
+        tokenizer->current_pos += 1;
+        return TOKEN_OR;
+      }
+      return TOKEN_PIPE;
+    case ';':
+      tokenizer->held = '\0';
+      tokenizer->current_pos += 1;
+      return TOKEN_SEMI;
+    case '&':
+      if ( input_buffer[tokenizer->current_pos+1] == '&' ){
+        tokenizer->held = '\0';
+        tokenizer->current_pos += 2;
+        return TOKEN_AND;
+      }
+      return next_redirect( tokenizer, -1 );
+    case '<':
+    case '>':
+      return next_redirect( tokenizer, -1 );
+  }
+
+  // A word is copied down over its own quotes and backslashes, so the write
+  // position never passes the read position
+  current_pos = write_pos = word_start = tokenizer->current_pos;
+  tokenizer->held = '\0';
+  tokenizer->quoted = false;
+
+  // Digits right against a < or > are the fd it redirects, as in 2>
+  while( input_buffer[current_pos] >= '0' &&
+      input_buffer[current_pos] <= '9' ){
+    current_pos += 1;
+  }
+  if ( input_buffer[current_pos] == '<' || input_buffer[current_pos] == '>' ){
+    fd = parse_fd( input_buffer + word_start, current_pos - word_start );
+    if ( fd != -1 ){
+      tokenizer->current_pos = current_pos;
+      return next_redirect( tokenizer, fd );
+    }
+  }
+  current_pos = word_start;
+
+  while( 1 ){
+    current_char = input_buffer[current_pos];
+
+    // Case A start with '
+    if ( current_char == '\'' ){
+      tokenizer->quoted = true;
+      current_pos += 1;
+      while( (current_char = input_buffer[current_pos]) != '\'' ){
+        if ( current_char == '\0' || current_char == '\n' ){
+          if ( !tokenizer->quiet ){
+            printf( UNEXPECTED_EOL );
+          }
+          return TOKEN_ERROR;
+        }
+        input_buffer[write_pos++] = current_char;
+        current_pos += 1;
+      }
+      current_pos += 1;
+    }
+
+    // Case B start with "
+    else if ( current_char == '\"' ){
+      tokenizer->quoted = true;
+      current_pos += 1;
+      while( (current_char = input_buffer[current_pos]) != '\"' ){
+        if ( current_char == '\0' || current_char == '\n' ){
+          if ( !tokenizer->quiet ){
+            printf( UNEXPECTED_EOL );
+          }
+          return TOKEN_ERROR;
+        }
+        // Only a quote, backslash or $ is escaped inside double quotes
+        if ( current_char == '\\' &&
+            ( input_buffer[current_pos+1] == '\"' ||
+              input_buffer[current_pos+1] == '\\' ||
+              input_buffer[current_pos+1] == '$' ) ){
+          current_pos += 1;
+          current_char = input_buffer[current_pos];
+        }
+        else if ( current_char == '$' ){
+          current_char = EXPAND_QUOTED;
+        }
+        input_buffer[write_pos++] = current_char;
+        current_pos += 1;
+      }
+      current_pos += 1;
+    }
+
+    // Case C escaped character
+    else if ( current_char == '\\' ){
+      tokenizer->quoted = true;
+      current_char = input_buffer[current_pos+1];
+      if ( current_char == '\0' || current_char == '\n' ){
+        current_pos += 1;
+        break;
+      }
+      input_buffer[write_pos++] = current_char;
+      current_pos += 2;
+    }
+
+    // Case D end of the word
+    else if ( current_char == '\0' || current_char == '\n' ||
+        current_char == ' '  || current_char == '\t' ||
+        current_char == '<'  || current_char == '>'  ||
+        current_char == '|'  || current_char == '&'  ||
+        current_char == ';' ){
+      break;
+    }
+
+    // Unquoted, $ and the glob characters are left for the expansion
+    else{
+      if ( current_char == '$' ){
+        current_char = EXPAND_MARK;
+      }
+      else if ( current_char == '*' ){
+        current_char = GLOB_STAR;
+      }
+      else if ( current_char == '?' && ( write_pos == word_start ||
+          input_buffer[write_pos-1] != EXPAND_MARK ) ){
+        current_char = GLOB_ONE;
+      }
+      else if ( current_char == '[' ){
+        current_char = GLOB_OPEN;
+      }
+      input_buffer[write_pos++] = current_char;
+      current_pos += 1;
+    }
+  }
+
+  // The null may land on the delimiter itself, so hold on to it
+  if ( write_pos == current_pos ){
+    tokenizer->held = current_char;
+  }
+  input_buffer[write_pos] = '\0';
+  tokenizer->current_pos = current_pos;
+
+  *word = input_buffer + word_start;
+
+  return TOKEN_WORD;
+}
+///////////////////////////////////////////////////////////////////////////////
+enum token_type next_redirect( struct tokenizer* tokenizer, int fd ){
+  // Reads the operator of a redirect, the longest that matches
+  char* input_buffer = tokenizer->input_buffer;
+  char current_char;
+  int current_pos;
+  bool bare = false;
+
+  current_char = tokenizer_peek( tokenizer );
+  current_pos = tokenizer->current_pos + 1;
+  tokenizer->held = '\0';
+
+  // &> and &>> send both stdout and stderr to the file
+  if ( current_char == '&' ){
+    if ( input_buffer[current_pos] != '>' ){
+      tokenizer->current_pos = current_pos;
+      return TOKEN_AMP;
+    }
+    fd = -1;
+    current_char = '>';
+    current_pos += 1;
+  }
+  else if ( fd == -1 ){
+    fd = current_char == '<' ? 0 : 1;
+    bare = true;
+  }
+
+  tokenizer->redirect_fd = fd;
+  tokenizer->redirect_type = current_char == '<' ?
+    REDIRECT_INPUT : REDIRECT_OUTPUT;
+  tokenizer->strip_tabs = false;
+
+  if ( tokenizer->redirect_fd != -1 && input_buffer[current_pos] == '&' ){
+    tokenizer->redirect_type = REDIRECT_DUP;
+    current_pos += 1;
+  }
+  else if ( current_char == '>' && input_buffer[current_pos] == '>' ){
+    tokenizer->redirect_type = REDIRECT_APPEND;
+    current_pos += 1;
+  }
+  else if ( current_char == '<' && input_buffer[current_pos] == '<' ){
+    current_pos += 1;
+    if ( input_buffer[current_pos] == '<' ){
+      tokenizer->redirect_type = REDIRECT_STRING;
+      current_pos += 1;
+    }
+    else{
+      tokenizer->redirect_type = REDIRECT_HEREDOC;
+      if ( input_buffer[current_pos] == '-' ){
+        tokenizer->strip_tabs = true;
+        current_pos += 1;
+      }
+    }
+  }
+  // The ( is left for next_process
+  else if ( bare && input_buffer[current_pos] == '(' ){
+    tokenizer->redirect_type = current_char == '<' ?
+      REDIRECT_PROCESS_IN : REDIRECT_PROCESS_OUT;
+  }
+
+  tokenizer->current_pos = current_pos;
+  return TOKEN_REDIRECT;
+}
+///////////////////////////////////////////////////////////////////////////////
+enum token_type next_process( struct tokenizer* tokenizer, char** word ){
+  // Finds the matching ), stepping over quotes and escapes
+  char* input_buffer = tokenizer->input_buffer;
+  char current_char, quote;
+  int current_pos, depth;
+
+  current_pos = tokenizer->current_pos + 1;
+  *word = input_buffer + current_pos;
+  depth = 1;
+  quote = '\0';
+
+  while( 1 ){
+    current_char = input_buffer[current_pos];
+    if ( current_char == '\0' || current_char == '\n' ){
+      return TOKEN_ERROR;
+    }
+
+    if ( current_char == '\\' && quote != '\'' ){
+      if ( input_buffer[current_pos+1] == '\0' ||
+          input_buffer[current_pos+1] == '\n' ){
+        return TOKEN_ERROR;
+      }
+      current_pos += 1;
+    }
+    else if ( quote != '\0' ){
+      if ( current_char == quote ){
+        quote = '\0';
+      }
+    }
+    else if ( current_char == '\'' || current_char == '\"' ){
+      quote = current_char;
+    }
+    else if ( current_char == '(' ){
+      depth += 1;
+    }
+    else if ( current_char == ')' && --depth == 0 ){
+      break;
+    }
+    current_pos += 1;
+  }
+
+  input_buffer[current_pos] = '\0';
+  tokenizer->current_pos = current_pos + 1;
+  tokenizer->held = '\0';
+
+  return TOKEN_WORD;
+}
+///////////////////////////////////////////////////////////////////////////////
+int parse_fd( const char* text, size_t length ){
+  // Reads a short run of digits as an fd
+  size_t i;
+  int fd = 0;
+
+  if ( length == 0 || length > REDIRECT_FD_DIGITS ){
+    return -1;
+  }
+  for( i = 0 ; i < length ; i++ ){
+    if ( text[i] < '0' || text[i] > '9' ){
+      return -1;
+    }
+    fd = fd * 10 + text[i] - '0';
+  }
+
+  return fd;
+}
+///////////////////////////////////////////////////////////////////////////////
+size_t parse_size( const char* text ){
+  // Reads a byte count, which may end in k or m
+  unsigned long long size;
+  char* end;
+
+  if ( text[0] < '0' || text[0] > '9' ){
+    return 0;
+  }
+  errno = 0;
+  size = strtoull( text, &end, 10 );
+  if ( *end == 'k' || *end == 'K' ){
+    size <<= 10;
+    end++;
+  }
+  else if ( *end == 'm' || *end == 'M' ){
+    size <<= 20;
+    end++;
+  }
+  if ( *end != '\0' || errno != 0 || size > INT_MAX ){
+    return 0;
+  }
+
+  return size;
+}
+///////////////////////////////////////////////////////////////////////////////
+char remove_whitespace( struct tokenizer* tokenizer ){
+  // Filters leading whitespace for the next token
+
+  char current_char;
+
+  while ( (current_char = tokenizer_peek( tokenizer )) == ' ' ||
+      current_char == '\t' ){
+    tokenizer->held = '\0';
+    tokenizer->current_pos += 1;
+  }
+
+  return current_char;
+}
+///////////////////////////////////////////////////////////////////////////////
+void* arena_alloc( struct arena* arena, size_t size ){
+  // Bumps the arena, moving to the next block or adding one when full
+  struct arena_block* block;
+  void* memory;
+
+  // Keep every allocation aligned for the pointer arrays
+  size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+  block = arena->current;
+  while ( block == NULL || block->used + size > block->size ){
+    if ( block != NULL && block->next != NULL &&
+        block->next->size >= size ){
+      // Reuse a block kept from an earlier line
+      block = block->next;
+      block->used = 0;
+      continue;
+    }
+
+    block = arena_add_block( arena, block,
+      size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE );
+  }
+
+  arena->current = block;
+  memory = block->data + block->used;
+  block->used += size;
+
+  return memory;
+}
+///////////////////////////////////////////////////////////////////////////////
+struct arena_block* arena_add_block( struct arena* arena,
+    struct arena_block* after, size_t size ){
+  // Links a new block in after the given one, or as the head
+  struct arena_block* block;
+
+  block = (struct arena_block *) malloc( sizeof(struct arena_block) + size );
+  if ( block == NULL ){
+    syserror( OUT_OF_MEMORY );
+  }
+  block->size = size;
+  block->used = 0;
+
+  if ( after == NULL ){
+    block->next = arena->head;
+    arena->head = block;
+  }
+  else{
+    block->next = after->next;
+    after->next = block;
+  }
+
+  return block;
+}
+///////////////////////////////////////////////////////////////////////////////
+char* arena_strndup( struct arena* arena, const char* string, size_t length ){
+  // Copies length characters into the arena and null terminates them
+  char* copy;
+
+  copy = (char *) arena_alloc( arena, length + 1 );
+  memcpy( copy, string, length );
+  copy[length] = '\0';
+
+  return copy;
+}
+///////////////////////////////////////////////////////////////////////////////
+void arena_reset( struct arena* arena ){
+  // Rewinds to the first block, every block is kept for reuse
+  arena->current = arena->head;
+  if ( arena->head != NULL ){
+    arena->head->used = 0;
+  }
+}
+///////////////////////////////////////////////////////////////////////////////
+void arena_free( struct arena* arena ){
+  // Frees the whole chain of blocks
+  struct arena_block* block;
+
+  while( (block = arena->head) != NULL ){
+    arena->head = block->next;
+    free( block );
+  }
+  arena->current = NULL;
+}
+///////////////////////////////////////////////////////////////////////////////
+void null_run_array(char * run_buffer_array[], int size){
+  // Sets every element of a char* array to null
+  int i;
+
+  for( i = 0 ; i < size ; i++ ){
+    run_buffer_array[i] = NULL;
   }
 }
 ///////////////////////////////////////////////////////////////////////////////
@@ -11,64 +11,742 @@
 #ifndef TERMINAL_H
 #define TERMINAL_H
 
-#ifndef DEBUG
- #define DEBUG 0
+/* The shell can be built as libterminal.a, without main, to be embedded.
+ *
+ * Parser   parse_line turns a line into a command_list: its pipelines, the
+ *            stages of each with their argv and redirects. It keeps
+ *            no state outside the list, so threads can parse at the same
+ *            time into lists of their own. command_list_clear empties a
+ *            list for the next line and command_list_free releases it.
+ * Executor jobs_init once, then proc_command_list runs a list. Its state
+ *            is the one struct executor of the process, as the cwd,
+ *            environment, signals and children are the process's, so it
+ *            is run from one thread.
+ */
+
+#ifndef SPAWN
+ #define SPAWN 1
 #endif
-/* Specifics what debug information will be printed.
- * DEBUG &
- *       1 Prints out the cases shell hits and the current position of the
- *           cursor after it is moved as well as the pipes symbols detected.
- *           Will print out the run_buffer_array array before forking and
- *           the pipe mode.
- *       2 Prints the cursor positions that are set for command_out when
- *           cutting out the string
- *       4 Prints the buffer input and what function is executed. Used mainly
- *           for batch mode debugging. Prompt will look like the line is
- *           typed in.
- */
-
-#define BUFFER_SIZE 1024
-#define ARG_COUNT 21
+/* Selects how commands are started.
+ * SPAWN 1 Uses posix_spawn, which glibc runs as clone(CLONE_VM|CLONE_VFORK)
+ *           so the shell's page tables are never copied. The pipes and
+ *           redirects become spawn file actions.
+ *       0 Uses fork and exec for every command.
+ */
 
+#define BUFFER_SIZE 1024 // Longest error message
+#define ARG_COUNT 16 // Starting argv size, doubled as needed
+#define REDIRECT_COUNT 4 // Starting redirects of a stage, doubled as needed
+#define REDIRECT_FD_DIGITS 4 // Longest fd number before < or >
+#define PROCESS_FD 63 // fd of a stage's first <(cmd), the next is one lower
+#define STATUS_UNKNOWN 127 // Exit status of a process reaped unrecorded
+#define HEREDOC_QUOTED 1 // The delimiter was quoted, the body is not expanded
+#define HEREDOC_TABS 2 // <<-, leading tabs are removed from the body
+#define HEREDOC_READ 4 // The body has replaced the delimiter
+#define ARENA_BLOCK_SIZE 16384
+#define READ_BLOCK_SIZE 65536
+#define PLUMB_SIZE 1048576 // Most asked of splice, tee or sendfile at once
+#define HASH_SIZE 256
+#define DEFAULT_PATH "/bin:/usr/bin"
+#define STATS_ENV "TERMINAL_STATS" // Set to time every pipeline
+#define TRACE_ENV "TERMINAL_TRACE" // fd number or file to trace to
+#define TRACE_BUFFER_SIZE 1024 // Longest trace event
+#define CACHE_ENV "TERMINAL_CACHE" // Set to cache parsed scripts
+#define PIPE_SIZE_ENV "TERMINAL_PIPE_SIZE" // Bytes for every pipe, k or m
+#define PIPEFAIL_ENV "TERMINAL_PIPEFAIL" // Set so any failed stage counts
+#define WORKERS_ENV "TERMINAL_WORKERS" // Workers to keep, experimental
+#define WORKERS_MAX 64 // Most workers the pool holds
+#define WORKER_FDS 64 // Most fds handed to one worker
+#define EXPAND_MARK '\001' // Stands for a $ the tokenizer left unquoted
+#define GLOB_STAR '\002' // An unquoted *
+#define GLOB_ONE '\003' // An unquoted ?
+#define GLOB_OPEN '\004' // An unquoted [
+#define EXPAND_QUOTED '\005' // A $ inside double quotes
+#define EXPAND_MARKS "\001\002\003\004\005" // Any of the above
+#define FIELD_MARK '\006' // Splits a word where an unquoted $ gave a space
+#define GLOB_CACHE_SIZE 64 // Buckets of directory listings
+#define GLOB_CACHE_DIRS 256 // Listings kept before the cache is emptied
+#define CACHE_SUFFIX ".cache" // Added to the script's path
+#define CACHE_MAGIC "TSHC"
+#define CACHE_VERSION 7
+#define CACHE_NONE 0xffffffffu
+#define CACHE_BACKGROUND 1
+#define CACHE_TIMED 2
+#define CACHE_ON_SUCCESS 4
+#define CACHE_ON_FAILURE 8
+
+#include<signal.h>
 #include<stdbool.h>
+#include<stdint.h>
+#include<sys/resource.h>
+#include<sys/types.h>
+#include<time.h>
+
+struct hash_entry{
+  char* name;              // Command as typed
+  char* path;              // Where it was found on PATH
+  unsigned int hits;       // Times it has been looked up
+  struct hash_entry* next; // Next entry in the same bucket
+};
+
+struct command_hash{
+  struct hash_entry* buckets[HASH_SIZE];
+  char* path_env;          // PATH the entries were found with
+  char* candidate;         // Path being tried during a search
+  size_t candidate_size;   // Bytes allocated for candidate
+};
+
+struct variable{
+  char* entry;            // NAME=value, as the children are given it
+  size_t name_length;     // Bytes of NAME
+  bool exported;          // Given to the children
+  struct variable* next;  // Next variable in the same bucket
+};
+
+struct variable_table{
+  struct variable* buckets[HASH_SIZE];
+  char** envp;            // The exported entries, NULL after a change
+  size_t exported;        // Entries envp holds
+  bool loaded;            // environ has been read in
+};
+
+struct reader{
+  int fd;           // Where the lines come from
+  char* buffer;     // Block buffer, or the whole file when mapped
+  size_t length;    // Bytes of input in buffer
+  size_t capacity;  // Bytes allocated for buffer
+  size_t start;     // First byte not handed out yet
+  size_t scanned;   // Bytes already searched for a newline
+  char* last_line;  // Copy of a mapped last line that has no newline
+  bool mapped;      // buffer is an mmap of a regular file
+  bool eof;         // Nothing more can be read
+  bool shared;      // fd is the stdin the children inherit
+  bool interactive; // Input is a terminal, so prompts are printed
+  size_t block;     // Bytes asked for by each read
+};
+
+enum token_type{
+  TOKEN_END,   // Newline or end of the line
+  TOKEN_WORD,  // Command, argument or file name
+  TOKEN_PIPE,     // |
+  TOKEN_REDIRECT, // <, >, >>, <&, >&, &>, &>>, <<<, <<, <<-, <( or >(,
+                  // with an optional fd first
+  TOKEN_AMP,      // &
+  TOKEN_SEMI,     // ;
+  TOKEN_AND,      // &&
+  TOKEN_OR,       // ||
+  TOKEN_ERROR  // Bad input, already reported
+};
+
+struct tokenizer{
+  char* input_buffer; // Line being cut up in place
+  int current_pos;    // Next character to read
+  char held;          // Character at current_pos covered by a word's null
+  bool quiet;         // Syntax errors are not printed
+  int redirect_fd;    // fd before a TOKEN_REDIRECT, -1 for stdout and stderr
+  int redirect_type;  // enum redirect_type of a TOKEN_REDIRECT
+  bool strip_tabs;    // The TOKEN_REDIRECT was <<-
+  bool quoted;        // The last word had quotes or backslashes
+};
+
+struct arena_block{
+  struct arena_block* next; // Blocks are kept in a chain and reused
+  size_t size;              // Bytes in data
+  size_t used;              // Bytes handed out since the last reset
+  char data[];
+};
+
+struct arena{
+  struct arena_block* head;    // First block, where a reset starts over
+  struct arena_block* current; // Block allocations are bumped from
+};
+
+struct builtin{
+  const char* name;                      // Command the builtin answers to
+  int (*run)( char* run_buffer_array[] ); // Returns the exit status
+};
+
+enum redirect_type{
+  REDIRECT_INPUT,  // n<file
+  REDIRECT_OUTPUT, // n>file, truncated
+  REDIRECT_APPEND, // n>>file
+  REDIRECT_DUP,    // n<&m or n>&m
+  REDIRECT_STRING, // n<<<word, the word and a newline
+  REDIRECT_HEREDOC, // n<<word, the lines after up to word
+  REDIRECT_PROCESS_IN, // <(cmd), read from /dev/fd/n
+  REDIRECT_PROCESS_OUT // >(cmd), written to /dev/fd/n
+};
+
+struct redirect{
+  int fd;                 // The command's fd that is changed
+  int source;             // fd copied onto it by REDIRECT_DUP, or the
+                          // HEREDOC_* flags until a here-document is read
+  enum redirect_type type;
+  char* file;             // File opened onto it by the others, the text of
+                          // a string or here-document, or the command
+  int open_fd;            // file as opened by the shell, or -1
+  int saved_fd;           // Shell's own fd while a builtin runs in it
+};
+
+struct stage{
+  char** run_buffer_array;           // argv, the last entry is NULL
+  char** assignments;                // NAME=value words before argv
+  unsigned int assignment_count;
+  unsigned int assignment_capacity;
+  char** envp;                       // With the assignments, or NULL for
+                                     // the shell's own
+  struct redirect* redirects;        // Applied in order after the pipes
+  unsigned int redirect_count;
+  unsigned int redirect_capacity;
+  unsigned int args_count;           // Arguments after the command
+  unsigned int args_capacity;        // Entries run_buffer_array can hold
+  size_t args_size;                  // Bytes execve needs for argv
+  const char* path;                  // Where argv[0] was found
+  const struct builtin* builtin;     // Set if argv[0] is a builtin
+  int fd[2];                         // Stdin and stdout handed to the child
+  pid_t pid;                         // Child running this stage
+  struct timespec start;             // When it was started, if timed
+};
+
+enum run_condition{
+  RUN_ALWAYS,     // First on the line, or after ; or &
+  RUN_ON_SUCCESS, // After &&, if the last status was 0
+  RUN_ON_FAILURE  // After ||, if it was not
+};
+
+struct pipeline{
+  struct stage* stages; // Every command between the pipe symbols
+  int count;            // Stages in use for the current line
+  int capacity;         // Stages allocated, grows by doubling
+  bool background;      // Ended by &, so it is not waited for
+  enum run_condition run_if; // Set by the operator before it
+  pid_t pgid;           // Process group with job control, or 0
+  int out_fd;           // Stdout of the last stage, 1 unless captured
+  bool timed;           // Reported on by time or the stats mode
+  size_t pipe_size;     // Set by pipesize, or 0 for PIPE_SIZE_ENV
+  double parse_time;    // Seconds parse_line took over the line
+  struct timespec start;   // When the shell began starting it, if timed
+  struct timespec spawned; // When every stage had been started
+};
+
+struct command_list{
+  struct pipeline* pipelines; // Pipelines of the line in order
+  int count;                  // Pipelines in use for the current line
+  int capacity;               // Pipelines allocated, grows by doubling
+  struct arena arena;         // Owns every argv of the line
+  bool quiet;                 // Syntax errors are not printed
+};
+
+enum cache_type{
+  CACHE_LINE,     // A parsed line, count pipelines follow
+  CACHE_RAW,      // A line that did not parse, kept as text
+  CACHE_PIPELINE, // count stages follow
+  CACHE_STAGE,    // count words starting at argv[offset]
+  CACHE_REDIRECT  // One of the redirects of the stage before
+};
+
+struct cache_record{
+  uint32_t type;        // enum cache_type
+  uint32_t count;       // Pipelines, stages or words that follow
+  uint32_t offset;      // Raw text in strings, first argv entry of a
+                        // stage, pipe size of a pipeline or the file of a
+                        // redirect, CACHE_NONE for a copy
+  uint32_t redirects;   // CACHE_REDIRECT records after a stage
+  uint32_t fd;          // fd a redirect changes
+  uint32_t source;      // fd a copy is taken from
+  uint32_t flags;       // CACHE_BACKGROUND and CACHE_TIMED, or the enum
+                        // redirect_type of a redirect
+  uint32_t assignments; // NAME=value entries at argv[offset] before the
+                        // words of a stage
+  uint64_t args_size;   // Bytes execve needs for the stage's argv
+};
+
+struct cache_header{
+  char magic[4];          // CACHE_MAGIC
+  uint32_t version;       // CACHE_VERSION
+  uint64_t script_size;   // The script the table was made from
+  int64_t script_mtime;
+  int64_t script_mtime_nsec;
+  uint64_t script_hash;   // FNV-1a of the whole script
+  uint32_t record_count;  // Then the records,
+  uint32_t argv_count;    // the argv entries, offsets into strings,
+  uint32_t strings_size;  // and the null terminated strings
+  uint32_t unused;
+};
+
+struct script_cache{
+  struct cache_header header;   // Key and sizes of the table
+  struct cache_record* records; // Every line of the script in order
+  uint32_t* argv;               // Words of each stage, CACHE_NONE ended
+  char* strings;                // Words, file names and raw lines
+  uint32_t record_capacity;     // Allocated while the table is built
+  uint32_t argv_capacity;
+  uint32_t strings_capacity;
+  char** argv_pointers;         // argv made into the pointers stages use
+  void* mapping;                // The cache file, or NULL if built here
+  size_t mapping_size;
+};
 
-enum pipe_flag{
-  NO_PIPE     = 0, // No pipe
-  PIPE_START  = 2, // Send into pipe (always strt with pipea)
-  PIPE_CONTA  = 4, // Draw from pipea and write to pipeb
-  PIPE_DRAINA = 5, // Drain the pipea
-  PIPE_CONTB  = 6, // Draw from pipeb and write to pipea
-  PIPE_DRAINB = 7  // Drain from pipeb
+enum process_state{
+  PROCESS_RUNNING,
+  PROCESS_STOPPED,
+  PROCESS_DONE
+};
+
+struct job_process{
+  pid_t pid;                // -1 if the stage never started
+  int status;               // From waitpid once done
+  enum process_state state;
+  struct rusage usage;      // From wait4 when reaped in the foreground
+  struct timespec end;      // When it was reaped in the foreground
+};
+
+struct job{
+  int id;                         // Shown as [id] and named as %id
+  pid_t pgid;                     // Process group, or 0 without job control
+  struct job_process* processes;  // One per stage
+  int count;                      // Processes in the job
+  char* command;                  // Text shown by jobs
+};
+
+struct parallel_job{
+  struct job_process* processes; // One per stage
+  int count;                     // Processes in the job
+  int running;                   // Processes not reaped yet
+  int output_fd;                 // Memory file holding stdout, or -1
+};
+
+struct job_table{
+  struct job* jobs;                      // Oldest first
+  int count;                             // Jobs in use
+  int capacity;                          // Jobs allocated
+  bool job_control;                      // Input is a terminal
+  pid_t shell_pgid;                      // Group to give the terminal back to
+  sigset_t job_signals;                  // Ignored by the shell, not the jobs
+  volatile sig_atomic_t child_changed;   // Set by the SIGCHLD handler
+};
+
+struct glob_dir{
+  dev_t dev;              // The directory, however it was named
+  ino_t ino;
+  struct timespec mtime;  // Its mtime when it was read
+  bool trusted;           // Read over a second after mtime, so no change
+                          // can hide in the same timestamp
+  char** names;           // Entries but . and .., sorted
+  size_t count;
+  char* strings;          // The names, each after a byte of its d_type
+  struct glob_dir* next;  // Next listing in the same bucket
+};
+
+struct glob_cache{
+  struct glob_dir* buckets[GLOB_CACHE_SIZE];
+  struct glob_dir* retired; // Replaced listings a walk may still be in
+  unsigned int count;       // Listings in the buckets
+};
+
+struct glob_list{
+  char** words;          // Words so far, in the arena
+  size_t count;
+  size_t capacity;
+  struct arena* arena;
+};
+
+struct worker_pool{
+  int sockets[WORKERS_MAX]; // Shell's end of each idle worker's socket
+  pid_t pids[WORKERS_MAX];  // The idle workers, the newest last
+  int count;
+};
+
+struct worker_request{
+  uint32_t size;      // Bytes after the request: the redirects, then the
+                      // path, argv and envp, each string null terminated
+  uint32_t argc;
+  uint32_t envc;
+  uint32_t redirects; // struct worker_redirect entries
+  int32_t floor;      // Above every fd the redirects name
+  int32_t pgid;       // Process group to join, -1 to stay in the shell's
+  uint32_t mask;      // The shell's umask
+};
+
+struct worker_redirect{
+  int32_t fd;         // The command's fd that is changed
+  int32_t source;     // fd copied onto it, or -1 for the next one sent
+};
+
+struct executor{
+  struct command_hash command_hash; // Commands already found on PATH
+  struct job_table job_table;       // Background and stopped pipelines
+  int trace_fd;                     // Where trace events go, or -1
+  long arg_max;                     // sysconf(_SC_ARG_MAX), once looked up
+  int status;                       // Of the last pipeline run, $?
+  struct glob_cache glob_cache;     // Directories globs have listed
+  struct variable_table variables;  // Shell and environment variables
+  bool pipefail;                    // PIPEFAIL_ENV was set for the line
+  struct worker_pool workers;       // Forked and waiting for a command
 };
 
 ///////////////////////////////////////////////////////////////////////////////
 //// Main shell thread
-int shell(void);
-/* Processes the user input and passes the input to proc_fork to fork the
- * given command and its arguments. proc_fork is invoked each time a
- * pipe symbol (|, < and >) is spotted and once more for the final command.
+int shell( const char* script );
+/* Processes the user input and passes the input to proc_command_list to
+ * fork the given commands and their arguments. The whole line is parsed
+ * first, with each pipe symbol (|) starting a new stage and each & ending
+ * a pipeline that runs in the background. ;, && and || end a pipeline too.
+ *
+ * script is a file to run commands from, or NULL for stdin. The prompt is
+ *   only printed when the input is a terminal.
+ *
+ * Returns the status of the last pipeline, or 1 if the script can not be
+ *   opened.
+ */
+
+bool parse_line( char* line, struct command_list* list );
+/* Cuts a line up in place and appends its pipelines to the list. Nothing is
+ * forked. Re-entrant, all the state is in line and list.
+ *
+ * line is the line, ending with a newline or a null. It is written to.
+ * list is the list the pipelines are added to. Their argvs point into line.
+ *
+ * Returns false, after printing the error, if the line is not valid. None
+ *   of its pipelines are kept then.
+ */
+
+///////////////////////////////////////////////////////////////////////////////
+//// Input Reader
+int reader_open( struct reader* reader, const char* script );
+/* Sets up the reader for the script, or stdin if script is NULL. A regular
+ * file that is not a terminal is mapped whole, and stdin is sought back
+ * to the next line before each command. A script file or a terminal is
+ * read in READ_BLOCK_SIZE blocks. Any other stdin, such as a pipe, is
+ * read a byte at a time, as it can not be sought back and the commands
+ * may read the lines after their own.
+ *
+ * reader is the reader to set up
+ * script is the file to open, which the children do not inherit
+ *
+ * Returns 0 or -1 with errno set if the script can not be opened.
+ */
+
+ssize_t reader_getline( struct reader* reader, char** line );
+/* Finds the next line in the buffer without copying it, reading another
+ * block if the line is not complete. Every byte is searched once.
+ *
+ * reader is the reader to take the line from
+ * line is set to the start of the line, which can be written to until the
+ *   next call. It ends with a newline, or a null for a last line without one.
+ *
+ * Returns the length of the line or -1 at the end of the input.
+ */
+
+void reader_release( struct reader* reader );
+/* When stdin is a mapped file, seeks it to the first unread line so a child
+ * reading stdin starts there, as it would if the shell read line by line.
+ *
+ * reader is the reader about to fork children
+ */
+
+void reader_resume( struct reader* reader );
+/* When stdin is a mapped file, skips past any input the children read.
+ *
+ * reader is the reader whose children have been reaped
+ */
+
+void heredoc_read( struct command_list* list, struct reader* reader );
+/* Reads the bodies of the here-documents of a parsed line from the lines
+ * after it, each up to its delimiter, in the order they were written. The
+ * words of the line are first copied into the list's arena, as reading
+ * more lines may move the buffer they were cut from. Unless the delimiter
+ * was quoted, \$, \\ and \` are escapes, a \ at the end of a line joins it
+ * to the next, and each $ is written as EXPAND_QUOTED. The end of input
+ * also ends a body, with a warning.
+ *
+ * The command of a <(cmd) or >(cmd) is not parsed until it runs, so the
+ * lines of any here-documents inside it are read whole, as heredoc_nested
+ * gives them, and kept after the command for parse_text. A here-document
+ * that already has its body is left alone, so more pipelines may be parsed
+ * into the list and it called again.
+ *
+ * list is the parsed line, each body replacing its delimiter as the file
+ * reader is where the line came from
+ */
+
+char* heredoc_nested( const char* command, struct reader* reader,
+  char* lines );
+/* Reads the lines of the here-documents inside a command that is parsed
+ * later, delimiters included and nothing expanded, going into any <(cmd)
+ * or >(cmd) inside it too.
+ *
+ * command is the command as typed
+ * reader is where the lines are read from
+ * lines is what has been read so far, or NULL
+ *
+ * Returns lines with the new ones added, NULL if there were none. It is
+ *   malloc'd and the caller frees it.
+ */
+
+bool parse_text( char* text, struct command_list* list );
+/* Parses the first line of text with parse_line and reads the bodies of
+ * its here-documents from the lines after it. For the commands of <(cmd),
+ * >(cmd) and parallel, which are parsed from text and not from the reader.
+ *
+ * text is cut up in place
+ * list is the list the pipelines are added to
+ *
+ * Returns what parse_line returns.
+ */
+
+void reader_close( struct reader* reader );
+/* Unmaps or frees the buffer and closes the script file.
+ *
+ * reader is the reader to close
+ */
+
+///////////////////////////////////////////////////////////////////////////////
+//// Script Cache
+int script_cache_open( struct script_cache* cache, const char* script,
+    struct reader* reader );
+/* Gets the parsed form of a script, so running it again skips the
+ * tokenizer and its copying. The table is kept in script CACHE_SUFFIX,
+ * keyed by the script's size, mtime and a hash of its text, and mapped
+ * when it matches. Otherwise the script is parsed whole from the reader
+ * and the table is written there, if it can be, for the next run.
+ *
+ * cache is the cache to fill
+ * script is the path of the script
+ * reader is the open reader of the script. It must have mapped it. Its
+ *   lines are used up if the script has to be parsed.
+ *
+ * Returns 0, or -1 if the script can not be cached, with the reader left
+ *   as it was.
+ */
+
+void script_cache_run( struct script_cache* cache,
+    struct command_list* list );
+/* Runs every line of a cached script, filling the list straight from the
+ * table. A line that did not parse is parsed now, printing its error.
+ *
+ * cache is the open cache
+ * list is the list each line is run from
+ */
+
+uint32_t script_cache_fill( struct script_cache* cache, uint32_t index,
+    struct command_list* list );
+/* Puts a parsed line of the table into a list. The argvs and file names
+ * point into the table, only the pipeline and stage slots are used.
+ *
+ * cache is the open cache
+ * index is the CACHE_LINE record
+ * list is the empty list to fill
+ *
+ * Returns the index of the next line.
+ */
+
+void script_cache_compile( struct script_cache* cache,
+    struct reader* reader );
+/* Parses every line of the reader into the table, without printing
+ * errors. A line that does not parse is kept as text.
+ *
+ * cache is the empty cache to build
+ * reader is the reader of the script
+ */
+
+void script_cache_add_line( struct script_cache* cache,
+    struct command_list* list );
+/* Appends the records, words and strings of a parsed line.
+ *
+ * cache is the cache being built
+ * list is the parsed line
+ */
+
+uint32_t script_cache_string( struct script_cache* cache, const char* string,
+    size_t length );
+/* Appends a string, and a null, to the strings of the table.
+ *
+ * Returns its offset.
+ */
+
+void* script_cache_grow( void* array, uint32_t* capacity, uint32_t needed,
+    size_t size );
+/* Doubles an array of the table being built until needed entries fit.
+ *
+ * array is the array, or NULL
+ * capacity is the number of entries allocated, updated
+ * needed is the number of entries that must fit
+ * size is the size of one entry
+ *
+ * Returns the array.
+ */
+
+int script_cache_load( struct script_cache* cache, const char* path );
+/* Maps a cache file if its header matches the key in cache->header and its
+ * size adds up.
+ *
+ * Returns 0, or -1 if there is no usable file.
+ */
+
+int script_cache_write( struct script_cache* cache, const char* path );
+/* Writes the table to a temporary file and renames it over path, so a
+ * reader never sees part of one.
+ *
+ * Returns 0, or -1 if it could not be written.
+ */
+
+int script_cache_link( struct script_cache* cache );
+/* Checks every record and offset of the table and turns the argv offsets
+ * into the pointers the stages use.
+ *
+ * Returns 0, or -1 if the table is not sound.
+ */
+
+void script_cache_close( struct script_cache* cache );
+/* Unmaps or frees the table.
  */
 
 ///////////////////////////////////////////////////////////////////////////////
 //// Fork Function and support
-void proc_fork( int* pfda, int* pfdb, char* run_buffer_array [],
-    char* io_pipe_array [], int arg_count, enum pipe_flag* _flags);
-/* This function processes the parsed array of run_buffer_array and creates
- * the fork as needed while updating the pipe status.
- *
- * pfda, pfdb are pipes that are created elsewhere that will be used, if
- *   the user uses pipes
- * run_buffer_array contains what will be argv for the child program invoked.
- *   The zeroth entry in the array is the name and the rest are args. The last
- *   entry MUST BE NULL.
- * io_pipe_array is an array containing file names that will be used for
- *   input or input. Mainly applies to the first and last command in the pipe
- *   sequence
- * arg_count denotes the number of entries contained in run_buffer_array. This
- *   is only used for debugging purposes as run_buffer_array should contain
- *   NULL as its last entry in the array.
- * pipe_flag denotes the current state of the system and how this function
- *   will ultimately work.
+void proc_command_list( struct command_list* list );
+/* Runs the pipelines of a parsed line in order with proc_pipeline, then
+ * clears the list. Each status is kept as executor.status. A pipeline after
+ * && is skipped unless the last status is 0, one after || unless it is not,
+ * so a failure stops the commands that depend on it before they are forked.
+ *
+ * list holds the pipelines parsed from the line
+ */
+
+int proc_pipeline( struct pipeline* pipeline, struct arena* arena );
+/* Runs every stage of a pipeline at the same time. The stdin and stdout
+ * of every stage are set up in one pass, creating the count - 1 pipes, then
+ * every stage is forked, and only then are the children reaped, so a stage
+ * that writes more than the pipe buffer can not deadlock waiting on a reader
+ * that has not been started. Nothing is forked if a stage has more
+ * arguments than ARG_MAX allows. A pipeline that is a single builtin is run
+ * in the shell instead.
+ *
+ * A background pipeline is added to the job table and not waited for.
+ * A foreground one that is stopped is added to it then. A timed one that
+ * finishes is reported on with time_report.
+ *
+ * pipeline holds the stages parsed from the line
+ * arena is the arena of the line, used for the wait bookkeeping
+ *
+ * Returns the exit status, as job_exit_status gives it. A command that is
+ *   not found is 127 and one that could not be started is 1. A background
+ *   pipeline is 0 and a stopped one 128 + SIGTSTP.
+ */
+
+int pipeline_start( struct pipeline* pipeline );
+/* The first half of proc_pipeline. Checks the stages, creates the pipes
+ * and starts every stage, builtins included, in a child, handing commands
+ * to idle workers while the pool has any. Nothing is waited for. The last
+ * stage writes to the pipeline's out_fd. The pipes are given F_SETPIPE_SZ
+ * of the pipeline's pipe_size, or of PIPE_SIZE_ENV, if either is set. One
+ * the kernel refuses is reported, and the rest keep the default.
+ *
+ * pipeline holds the stages parsed from the line. Each stage's pid is set,
+ *   -1 for one that could not be started.
+ *
+ * Returns 0, or -1 after printing the error if nothing was started.
+ */
+
+pid_t proc_spawn( struct pipeline* pipeline, struct stage* stage );
+/* This function starts one stage of the pipeline with posix_spawn, which
+ * is cheaper than fork as the shell grows. The command is run from the path
+ * proc_pipeline resolved, and searched for again if that has gone away.
+ * The file redirects are opened in the parent, then file actions move the
+ * stage fds and the files onto stdin and stdout. Everything else the shell
+ * opened is close on exec. With job control the child joins the process
+ * group of the pipeline. It does not wait for the child.
+ *
+ * pipeline is the pipeline the stage belongs to
+ * stage is the stage to start, see proc_fork
+ *
+ * Returns the pid of the child, or -1 after printing the error if the
+ *   command could not be run or a redirect could not be opened.
+ */
+
+int proc_builtin( struct stage* stage );
+/* Runs a builtin in the shell process. Its redirect files are moved onto
+ * stdin and stdout for the call and the shell's own are put back after,
+ * and its assignments are set for the call and undone after.
+ *
+ * stage is a stage whose builtin is set
+ *
+ * Returns the exit status of the builtin, or 1 if a redirect failed.
+ */
+
+int stage_open_files( struct stage* stage );
+/* Opens the redirect files of a stage in the shell, close on exec, and
+ * prints the error if one can not be opened. Input is never created and
+ * output is truncated unless appended to. Strings and here-documents come
+ * from redirect_text and <(cmd) and >(cmd) from proc_substitute. Each is
+ * moved above every fd the redirects name, so applying them in order never
+ * closes one still to come.
+ *
+ * stage is the stage whose redirects are opened into their open_fd
+ *
+ * Returns 0, or -1 if a file could not be opened. Nothing is left open then.
+ */
+
+int redirect_text( const char* text, bool newline );
+/* Makes an fd to read a string or here-document from, without a file. Text
+ * that fits in a pipe without blocking is written into one, longer text
+ * into a memfd that is then rewound.
+ *
+ * text is the expanded text
+ * newline adds a newline after it, as <<< does
+ *
+ * Returns the fd to read from, close on exec, or -1 on failure.
+ */
+
+int proc_substitute( struct redirect* redirect );
+/* Starts the command of <(cmd) or >(cmd) in a child of the shell, which
+ * parses and runs it as a line of its own with its stdout, or stdin, on a
+ * pipe. The child closes every fd above stderr but the trace, as an exec
+ * would. The shell does not wait for it, it is reaped with the other
+ * children that are not jobs.
+ *
+ * redirect is the REDIRECT_PROCESS_IN or REDIRECT_PROCESS_OUT
+ *
+ * Returns the shell's end of the pipe, close on exec, or -1 on failure.
+ */
+
+void stage_close_files( struct stage* stage );
+/* Closes the files stage_open_files opened, once the child has them.
+ *
+ * stage is the stage whose redirects are closed
+ */
+
+int stage_redirect_floor( struct stage* stage );
+/* Finds the lowest fd no redirect of the stage names, and at least 3.
+ *
+ * stage is the stage to look at
+ */
+
+pid_t proc_fork( struct pipeline* pipeline, struct stage* stage );
+/* This function forks one stage of the pipeline. The redirect files are
+ * opened first, in the shell. The child moves the stage fds onto its stdin
+ * and stdout, closes every other pipe end, applies the redirects, which
+ * take priority over the pipes, and then execs.
+ * It does not wait for the child. Used in place of proc_spawn when SPAWN
+ * is 0, and for builtins in a pipeline, which run in the child without an
+ * exec.
+ *
+ * pipeline is the pipeline the stage belongs to, whose pipe ends the child
+ *   closes.
+ * stage is the stage to fork. Its run_buffer_array contains what will be
+ *   argv for the child program invoked. The zeroth entry in the array is the
+ *   name and the rest are args. The last entry MUST BE NULL.
+ *
+ * Returns the pid of the child, or -1 if a redirect file could not be
+ *   opened.
+ */
+
+void proc_close_fds( int keep );
+/* Closes every fd above stderr but keep and the trace, in a child of the
+ * shell that is not about to exec, so it holds no pipe or socket open
+ * while it runs.
+ *
+ * keep is an fd to leave open, or -1
  */
 
 void syserror(const char *s);
@@ -78,118 +756,841 @@ void syserror(const char *s);
  * s is an error message string that will be displayed before the child exits.
  */
 
+///////////////////////////////////////////////////////////////////////////////
+//// Worker Pool
+void pool_refill( void );
+/* Forks idle workers until WORKERS_ENV of them are waiting, or lets the
+ * extra ones go if it has been lowered. Every command handed off uses up a
+ * worker, so this saves no forks. It only keeps them off the way to a
+ * command, being called where the shell is idle: at the start, before an
+ * interactive prompt waits and after a line of assignments. Batch input
+ * has no idle time, so once the pool is empty its commands are spawned.
+ */
+
+void pool_forget( void );
+/* Closes the shell's ends of the workers' sockets in a child of the shell.
+ * The workers are the shell's children and can only be waited for by it.
+ */
+
+int worker_start( void );
+/* Forks one worker on a socket pair and adds it to the pool once it has
+ * written a byte to say it is waiting, so its start is not left to slow
+ * down the command it is given.
+ *
+ * Returns 0, or -1 if the socket or the fork failed or the worker died.
+ */
+
+void worker_main( int socket );
+/* Runs in the worker. It waits for one worker_request, with the stage's
+ * stdin, stdout and stderr, the shell's current directory and each opened
+ * redirect file passed as SCM_RIGHTS. It changes to the directory, takes
+ * the shell's umask, moves the fds into place as proc_fork would, and
+ * execs. Never returns, the worker exits if the shell closes the socket.
+ *
+ * socket is the worker's end of the socket pair
+ */
+
+pid_t proc_worker( struct pipeline* pipeline, struct stage* stage );
+/* Starts one stage by handing it to an idle worker, so no fork is on the
+ * way to the exec. The pid is the worker's, a child of the shell like any
+ * other. The worker was forked earlier, so the current directory and umask
+ * are sent with the command. An exec failure is reported by the worker,
+ * which exits as proc_fork's child would. A stage copying an fd of the
+ * shell's own above stderr, or with more than WORKER_FDS fds, is started
+ * by proc_spawn or proc_fork instead, as is one whose worker has died or
+ * whose directory cannot be opened.
+ *
+ * pipeline is the pipeline the stage belongs to
+ * stage is the stage to start, its path already found
+ *
+ * Returns the pid, or -1 if a redirect file could not be opened.
+ */
+
+///////////////////////////////////////////////////////////////////////////////
+//// Expansion
+void pipeline_expand( struct pipeline* pipeline, struct arena* arena );
+/* Expands the words of every stage just before the pipeline is run, so
+ * they see the state left by the pipelines before them on the line, files
+ * included. Each word goes through word_expand, is split into fields where
+ * an unquoted $ gave a space, and each field then through glob_expand, a
+ * pattern that matches nothing being kept as written. A word left empty by
+ * unquoted $ alone is dropped. Assignments, redirect files, strings and
+ * here-documents are expanded but not split or globbed, and the command of
+ * a process substitution is left for its own parse. A stage with a word
+ * to expand gets an argv of its own from the arena, as the one it has may
+ * belong to the script cache. A stage with assignments gets an envp from
+ * stage_envp.
+ *
+ * pipeline is the pipeline about to be run
+ * arena is the per line arena the expanded words come from
+ */
+
+char* word_expand( char* word, struct arena* arena, bool split );
+/* Replaces each EXPAND_MARK and EXPAND_QUOTED in a word. $NAME and ${NAME}
+ * become the variable's value, or nothing if it is not set, $? becomes
+ * executor.status and $$ the shell's pid. A mark before anything else is
+ * put back as a $. Glob marks are left for glob_expand.
+ *
+ * word is a word cut out by next_token
+ * arena is the per line arena the expanded word comes from
+ * split writes FIELD_MARK for each space, tab or newline an unquoted $
+ *   gave
+ *
+ * Returns word itself if it has no mark, otherwise the expanded copy.
+ */
+
+const char* word_variable( const char* mark, const char** after,
+    char number[24] );
+/* Reads the expansion a mark starts.
+ *
+ * mark is the EXPAND_MARK or EXPAND_QUOTED
+ * after is set to the first character after the expansion
+ * number is room for $? or $$ to be written to
+ *
+ * Returns the value, "" for an unset variable, or NULL if the mark does
+ *   not start an expansion.
+ */
+
+///////////////////////////////////////////////////////////////////////////////
+//// Variables
+struct variable* variable_find( const char* name, size_t length );
+/* Looks a variable up, reading environ into the table the first time.
+ *
+ * name is the name, which need not be null terminated
+ * length is the bytes of name
+ *
+ * Returns the variable, or NULL if it is not set.
+ */
+
+const char* variable_value( const char* name );
+/* The shell's getenv, which sees unexported variables too.
+ *
+ * name is the null terminated name
+ *
+ * Returns the value, or NULL if it is not set.
+ */
+
+void variable_set( const char* name, size_t length, const char* value,
+    bool exported );
+/* Sets a variable. A change to an exported one drops the envp, to be made
+ * again when a command next needs it.
+ *
+ * name is the name, which need not be null terminated
+ * length is the bytes of name
+ * value is the new value, which may be the old one's
+ * exported exports the variable. False leaves it as it was, and a new
+ *   one unexported.
+ */
+
+void variable_assign( const char* assignment, bool exported );
+/* Sets a variable from a NAME=value word. See variable_set.
+ */
+
+void variable_unset( const char* name );
+/* Removes a variable, if it is set.
+ *
+ * name is the null terminated name
+ */
+
+size_t variable_name_length( const char* word );
+/* Measures the name at the start of a word, [A-Za-z_][A-Za-z0-9_]*.
+ *
+ * word is the word
+ *
+ * Returns the bytes of the name, 0 if it does not start with one.
+ */
+
+unsigned int variable_bucket( const char* name, size_t length );
+/* Hashes a variable name.
+ *
+ * Returns the bucket, less than HASH_SIZE.
+ */
+
+char** variables_envp( void );
+/* The environment the commands are started with. It is built from the
+ * exported variables only when one has changed since it was last built, so
+ * every command in between is started with the same array.
+ *
+ * Returns the envp, NULL terminated.
+ */
+
+char** stage_envp( struct stage* stage, struct arena* arena );
+/* Builds the envp for a stage with assignments: the shell's, with each
+ * assignment replacing the entry of the same name or added after them.
+ *
+ * stage is the stage, whose assignments are already expanded
+ * arena is the per line arena the envp comes from
+ *
+ * Returns the envp.
+ */
+
+///////////////////////////////////////////////////////////////////////////////
+//// Globbing
+size_t glob_expand( const char* pattern, struct glob_list* matches );
+/* Adds the paths a pattern matches, sorted. *, ? and [...] match within a
+ * path component, and a component that is ** matches any number of
+ * directories. A name starting with . is only matched by a pattern that
+ * starts with one. Directories are listed through the glob cache.
+ *
+ * pattern is a word holding GLOB_STAR, GLOB_ONE or GLOB_OPEN
+ * matches is the list the paths are added to
+ *
+ * Returns how many paths were added.
+ */
+
+void glob_walk( struct glob_list* matches, const char* prefix,
+    const char* pattern );
+/* Matches the first component of pattern in the directory prefix and goes
+ * on with the rest of it in each directory that matched.
+ *
+ * matches is the list full matches are added to
+ * prefix is the path so far, empty or ending in a /
+ * pattern is what is left to match
+ */
+
+struct glob_dir* glob_dir_read( const char* path );
+/* Lists a directory, from the cache if it has not changed since it was
+ * read. The listing stays valid until the next glob_expand.
+ *
+ * path is the directory
+ *
+ * Returns the listing, or NULL if the directory can not be read.
+ */
+
+void glob_dir_free( struct glob_dir* dir );
+/* Frees a listing.
+ *
+ * dir is the listing to free
+ */
+
+void glob_cache_clear( void );
+/* Frees every listing in the glob cache.
+ */
+
+bool glob_match( const char* pattern, const char* end, const char* name );
+/* Matches one path component against a name.
+ *
+ * pattern is the component
+ * end is where the component stops
+ * name is the directory entry
+ */
+
+const char* glob_class( const char* pattern, const char* end, char c,
+    bool* match );
+/* Reads a [...] class, with ! or ^ to negate it and - for ranges.
+ *
+ * pattern is just after the GLOB_OPEN
+ * end is where the component stops
+ * c is the character to test
+ * match is set if the class holds c
+ *
+ * Returns the character after the ], or NULL if the class is not closed.
+ */
+
+char glob_char( char c );
+/* Returns the character a mark was typed as, or c if it is not a mark.
+ */
+
+bool glob_magic( const char* pattern, const char* end );
+/* Checks if a pattern has a *, a ? or a closed [.
+ *
+ * pattern is the start of the pattern
+ * end is where it stops
+ */
+
+char* glob_literal( const char* word, const char* end, struct arena* arena );
+/* Copies a word with its glob marks put back as the characters typed.
+ *
+ * word is the start of the word
+ * end is where it stops
+ * arena is the per line arena the copy comes from
+ */
+
+void glob_list_add( struct glob_list* list, char* word );
+/* Appends a word, doubling the list in its arena when full.
+ *
+ * list is the list to add to
+ * word is the word
+ */
+
+int glob_compare( const void* a, const void* b );
+/* qsort comparison of two char* by strcmp.
+ */
+
 ///////////////////////////////////////////////////////////////////////////////
 //// Command Manipulation Functions
-int command_out( char* input_buffer, int previous_end,
-    int current_pos, bool *is_command, char* run_buffer_array[],
-    unsigned int* args );
-/* This command "cuts" out the argument in the input_buffer, allocates the
- * correct amount of memory and loads it in run_buffer_array
- *
- * This assumes previous_end < current_pos and both are valid positions in
- *   input_buffer.
- * run_buffer_array must be allocated already if we are adding a new element
- *   args is the current number of non-null elements in run_buffer_array and
- *   must be less than ARG_COUNT - 1. Last element must be null.
- *
- * input_buffer is the input buffer that will be parsed
- * previous_end is the start position that will be cut
- * current_pos is the end position that will be cut
- * is_command states if the current string cut is a command that should
+void command_out( char* word, bool *is_command, struct stage* stage,
+    struct arena* arena );
+/* This command loads a word cut out by next_token in the run_buffer_array
+ * of the stage. The word is not copied, the entry points into the input
+ * buffer. When run_buffer_array is full it is doubled in the arena, so
+ * there is no limit on the number of arguments short of ARG_MAX, which
+ * proc_pipeline checks against args_size.
+ *
+ * word is the null terminated word to add
+ * is_command states if the current word is a command that should
  *   create a new run_buffer_array or add to the end of the current one
- * run_buffer_array is the array that will receive the new string
- * args will contain the new args_count once the operation is completed
+ * stage is the stage receiving the word. Its args_count, args_capacity and
+ *   args_size are updated.
+ * arena is the per line arena a larger run_buffer_array comes from
+ */
+
+void stage_add_assignment( struct stage* stage, char* word,
+    struct arena* arena );
+/* Appends a NAME=value word written before the command of a stage. When
+ * the array is full it is doubled in the arena.
  *
- * This will current the new current_pos if it needs to be changed
+ * stage is the stage receiving the assignment
+ * word is the word cut out by next_token
+ * arena is the per line arena the array comes from
  */
 
-int modify_fin_fout( char* input_buffer, int previous_end,
-    int current_pos, bool mode, char* io_pipe_array[]);
-/* Redirects either the input or output to a file.
+struct redirect* stage_add_redirect( struct stage* stage,
+    struct arena* arena );
+/* Appends a redirect to a stage. The redirects are applied in the order
+ * they are written, so 2>&1 >file and >file 2>&1 differ as they do in sh.
+ * When the array is full it is doubled in the arena.
  *
- * This assumes previous_end < current_pos and both are valid positions in
- *   input_buffer.
- * Does not check if io_pipe_array already contains a value in the new field
- *   before allocating.
+ * stage is the stage receiving the redirect
+ * arena is the per line arena the array comes from
+ *
+ * Returns the new redirect, not yet filled in but with open_fd and saved_fd
+ *   set to -1.
+ */
+
+int parse_fd( const char* text, size_t length );
+/* Reads the fd number of a redirect.
  *
- * input_buffer is the current input buffer
- * previous_end like command_out is the start string position that will be cut
- * current_pos is the end string position that will be cut
- * mode states if it is the input (true) or output (false) that will be modified
- * io_pipe_array is an array holding the current input/output file that will
- * be used
+ * text is the digits
+ * length is how many characters of text to read
  *
+ * Returns the fd, or -1 if text is not 1 to REDIRECT_FD_DIGITS digits.
  */
 
 ///////////////////////////////////////////////////////////////////////////////
-//// Support String Manipulation Functions
-void check_ctrl_d( char* input_buffer, int length );
-/* Checks if the input_buffer contains a ^d, escape signal.
+//// Tokenizer
+void tokenizer_start( struct tokenizer* tokenizer, char* input_buffer );
+/* Sets the tokenizer up to cut a new line.
+ *
+ * tokenizer is the tokenizer to reset
+ * input_buffer is the line, ending with a newline or a null. It is written to.
+ */
+
+char tokenizer_peek( struct tokenizer* tokenizer );
+/* Returns the character at the cursor. When the null ending the previous
+ * word was written over that character, the held copy is returned instead.
  *
- * length < BUFFER_SIZE
+ * tokenizer is the tokenizer to look at
+ */
+
+enum token_type next_token( struct tokenizer* tokenizer, char** word );
+/* Cuts the next token out of the line without copying. A word has its
+ * quotes and backslashes processed in place, sliding the characters down
+ * over them, and is ended by writing a null into the input buffer. Inside
+ * single quotes nothing is escaped, inside double quotes only \", \\ and \$
+ * are. Quoted and unquoted pieces next to each other form one word. A $
+ * that is not escaped is written as EXPAND_MARK, or EXPAND_QUOTED inside
+ * double quotes, for word_expand to find. Unquoted, *, ? and [ are written
+ * as GLOB_STAR, GLOB_ONE and GLOB_OPEN for glob_expand, except the ? of $?.
  *
- * input_buffer is the buffer to be checked.
- * length is the length of the buffer passed.
+ * tokenizer is the tokenizer holding the line and the cursor
+ * word is set to the start of the word when TOKEN_WORD is returned
+ *
+ * Returns the type of the token. TOKEN_ERROR is returned, after printing
+ *   the error, if a quote is not closed. For TOKEN_REDIRECT the tokenizer's
+ *   redirect_fd and redirect_type say which it is.
  */
 
-void purge_string( char* buffer, int length );
-/* Writes a string with null characters.
+enum token_type next_process( struct tokenizer* tokenizer, char** word );
+/* Cuts out the command of <(cmd) or >(cmd) as typed, up to the ) that
+ * closes the one at the cursor. Quotes and backslashes are skipped over but
+ * left for the command to be parsed with later.
  *
- * length should be the length of buffer
+ * tokenizer is the tokenizer whose cursor is on the (
+ * word is set to the command
  *
- * buffer is the buffer it will write \0 to
- * length is the length of said buffer
+ * Returns TOKEN_WORD, or TOKEN_ERROR if the ) is missing.
  */
 
-char remove_whitespace( char* input_buffer, int* previous_end,
-    int* current_pos);
+enum token_type next_redirect( struct tokenizer* tokenizer, int fd );
+/* Reads the redirect operator at the cursor, the longest of <, <&, >, >>,
+ * >&, &>, &>>, <<<, << and <<-. A < or > with no fd before a ( is a process
+ * substitution, the cursor being left on the (.
+ *
+ * tokenizer is the tokenizer whose cursor is on < > or &
+ * fd is the fd written before the operator, or -1 for the default
+ *
+ * Returns TOKEN_REDIRECT, or TOKEN_AMP for an & that is not followed by >.
+ */
+
+///////////////////////////////////////////////////////////////////////////////
+//// Support String Manipulation Functions
+size_t parse_size( const char* text );
+/* Reads a size such as 1048576, 256k or 1m.
+ *
+ * text is the size
+ *
+ * Returns the bytes, or 0 if text is not a size up to INT_MAX.
+ */
+
+char remove_whitespace( struct tokenizer* tokenizer );
 /* Reads all whitespace and returns the first non-whitespace character
  * it sees.
  *
- * input_buffer is the buffer that will be processed
- * previous_end, current_pos are values of the current cursor position that
- *   will be moved.
+ * tokenizer is the tokenizer whose cursor will be moved
  *
  * Returns the first non-whitespace character it finds. This may be '\0'
  */
 
 ///////////////////////////////////////////////////////////////////////////////
-//// Memory Management of char *[]
-void free_run_array(char * run_buffer_array[], int size);
-/* Frees all elements in run_buffer_array and sets it to null
+//// Command Hash
+const char* command_hash_lookup( const char* name );
+/* Resolves a command to the file that will be run, like bash's hash. The
+ * first lookup searches PATH and remembers the result, later ones are a
+ * table lookup. The table is emptied whenever PATH changes.
  *
- * run_buffer_array is the array that will be emptied
- * size should be length of run_buffer_array
+ * name is the command. One holding a / is returned as it is.
+ *
+ * Returns the path, valid until the table is next changed, or NULL if the
+ *   command is not on PATH. Misses are not remembered.
  */
 
-void null_run_array(char *[], int);
-/* Nulls all elements in run_buffer_array. Does NOT free the array
+unsigned int command_hash_bucket( const char* name );
+/* Hashes a command name.
  *
- * run_buffer_array is the array that will be nulled
- * size should be length of run_buffer_array
+ * name is the command to hash
+ *
+ * Returns the bucket, less than HASH_SIZE.
+ */
+
+void command_hash_forget( const char* name );
+/* Removes a command from the table, if it is there.
+ *
+ * name is the command to remove
+ */
+
+void command_hash_clear( void );
+/* Removes every command from the table.
+ */
+
+int command_hash_builtin( char* run_buffer_array[] );
+/* The hash builtin. With no arguments prints each command's hits and path.
+ * -r empties the table and any other argument is looked up again.
+ *
+ * run_buffer_array is the argv of the builtin
+ *
+ * Returns 1 if an argument was not found, otherwise 0.
+ */
+
+///////////////////////////////////////////////////////////////////////////////
+//// Job Control
+void jobs_init( bool interactive );
+/* Installs the SIGCHLD handler. When the shell reads from a terminal it
+ * also turns on job control: the shell takes its own process group and the
+ * terminal, and ignores the keyboard signals, which every job gets back.
+ *
+ * interactive is true if the input is a terminal
+ */
+
+void jobs_sigchld( int signal );
+/* SIGCHLD handler. Only sets child_changed for jobs_update to see.
+ */
+
+struct job* job_add( struct pipeline* pipeline );
+/* Adds a started pipeline to the job table, copying its pids and rebuilding
+ * its text from the argvs, as the line has been cut up in place.
+ *
+ * pipeline is the pipeline the job is made from
+ *
+ * Returns the job, valid until the table next changes.
+ */
+
+void job_remove( struct job* job );
+/* Frees a job and removes it from the table.
+ *
+ * job is the job to remove
+ */
+
+enum process_state job_state( struct job_process* processes, int count );
+/* Works out the state of a job from its processes. Running while any runs,
+ * stopped while any is stopped, otherwise done.
+ *
+ * processes are the processes of the job
+ * count is the number of processes
+ */
+
+void job_process_update( struct job_process* process, int status );
+/* Records a status from waitpid in a process.
+ *
+ * process is the process the status is for
+ * status is the status waitpid returned
+ */
+
+void jobs_update( void );
+/* Reaps every child that has changed with waitpid(-1, WNOHANG), if the
+ * SIGCHLD handler has run since last time, and updates the job table.
+ * Only called between lines, when there is no foreground job.
+ */
+
+void jobs_record( pid_t pid, int status );
+/* Records a status reaped with waitpid(-1) in the job table.
+ *
+ * pid is the child that was reaped, which may not be in any job
+ * status is the status waitpid returned
+ */
+
+void jobs_notify( void );
+/* Removes the finished jobs, printing Done for each with job control.
+ */
+
+enum process_state job_wait( struct job_process* processes, int count,
+    pid_t pgid, bool foreground );
+/* Waits until every process of a job is done or one is stopped. Reaps with
+ * wait4, keeping each process's usage and the time it was reaped. One that
+ * another waitpid reaped has its status from jobs_record, or if nothing
+ * recorded it, is done with STATUS_UNKNOWN.
+ *
+ * processes are the processes to wait for
+ * count is the number of processes
+ * pgid is the process group of the job, or 0
+ * foreground is true to hand the job the terminal while waiting
+ *
+ * Returns PROCESS_DONE or PROCESS_STOPPED.
+ */
+
+int job_exit_status( struct job_process* processes, int count );
+/* Returns the exit status of the last process, 128 + the signal if it was
+ * killed or stopped. With executor.pipefail it is the last process that did
+ * not exit 0 instead, if there is one.
+ */
+
+void job_continue( struct job* job );
+/* Marks a job running and sends it SIGCONT.
+ *
+ * job is the job to continue
+ */
+
+struct job* job_find( const char* spec, const char* builtin );
+/* Finds a job from a builtin's argument, printing an error if there is none.
+ *
+ * spec is %id, a pid or an id. NULL is the newest job.
+ * builtin is the name used in the error
+ */
+
+int builtin_jobs( char* run_buffer_array[] );
+/* jobs. Lists every job with its state, then forgets the finished ones.
  */
 
-void show_io( char* io_pipe_array[]);
-/* Prints the current state of io_pipe_array.
+int builtin_wait( char* run_buffer_array[] );
+/* wait [job ...]. Waits for each job, or every job, to finish or stop. A
+ * stopped job stays in the table for fg and bg. Returns the exit status of
+ * the last job waited for.
+ */
+
+int builtin_fg( char* run_buffer_array[] );
+/* fg [job]. Continues the job in the foreground and waits for it.
+ */
+
+int builtin_bg( char* run_buffer_array[] );
+/* bg [job]. Continues a stopped job in the background.
+ */
+
+///////////////////////////////////////////////////////////////////////////////
+//// Parallel
+int builtin_parallel( char* run_buffer_array[] );
+/* parallel [-j jobs] [-k] command ... Runs each argument as a pipeline of
+ * its own, parsed like a line, with up to jobs of them running at once.
+ * jobs is capped at the number of cores, which is also the default. The
+ * jobs' stdout goes to a memory file each and is printed whole when the job
+ * ends, or with -k in the order they were given. stderr is not kept apart.
+ *
+ * Returns the number of jobs that failed, at most 101, or 2 for bad usage.
+ */
+
+void parallel_output( struct parallel_job* job );
+/* Copies what a parallel job wrote to stdout with sendfile and closes its
+ * memory file.
+ *
+ * job is the finished job
+ */
+
+///////////////////////////////////////////////////////////////////////////////
+//// Plumbing
+int builtin_pcat( char* run_buffer_array[] );
+/* pcat [file ...]. Copies each file, - or no file for stdin, to stdout
+ * like cat, with sendfile or splice so the data never passes through the
+ * shell. It has a name of its own, so cat is still the real one.
+ */
+
+int builtin_ptee( char* run_buffer_array[] );
+/* ptee [-a] [file ...]. Copies stdin to stdout and to each file like tee,
+ * truncating them or appending with -a. When stdin is a pipe, each chunk
+ * is duplicated with tee(2) into a scratch pipe and spliced to a file, then
+ * spliced from stdin to stdout, so no byte is copied to user space.
+ * Otherwise it is read and written by hand.
+ */
+
+int plumb_copy( int in, int out );
+/* Copies in to out until the end of in. sendfile is used when in is a
+ * regular file and splice when either is a pipe, falling back to read and
+ * write for anything the kernel turns down.
+ *
+ * Returns 0, or -1 with errno set.
+ */
+
+int plumb_move( int in, int out, size_t length );
+/* Splices exactly length bytes from the pipe in to out, reading and
+ * writing them if out can not be spliced to.
+ *
+ * Returns 0, or -1 if the bytes could not all be moved.
+ */
+
+int plumb_scratch( int scratch[2] );
+/* Makes the pipe ptee tees each chunk into, given the size of the stdin
+ * pipe so every tee of a round takes the same bytes.
+ *
+ * scratch is set to the read and write ends
+ *
+ * Returns 0, or -1 with nothing left open if either call failed.
+ */
+
+int plumb_tee_copy( int* targets, int count );
+/* ptee for a stdin that is not a pipe. Reads stdin and writes each block
+ * to every target that is not -1.
+ *
+ * Returns 0, or 1 if anything failed.
+ */
+
+int plumb_write( int fd, const char* buffer, size_t length );
+/* Writes the whole buffer, retrying short writes.
+ *
+ * Returns 0, or -1 with errno set.
+ */
+
+///////////////////////////////////////////////////////////////////////////////
+//// Timing
+void time_report( struct pipeline* pipeline, struct job_process* processes );
+/* Prints to stderr the real, user and system time, max RSS and voluntary
+ * and involuntary context switches of each stage, then the shell's own
+ * time parsing the line and starting the stages, then the totals. Used for
+ * a pipeline after the time prefix, or any when STATS_ENV is set. A builtin
+ * run in the shell is shown with the shell's usage over the call, and no
+ * max RSS as the shell's peak is not its own.
+ *
+ * pipeline is the finished pipeline
+ * processes are its reaped processes, one per stage
+ */
+
+double time_elapsed( const struct timespec* start,
+    const struct timespec* end );
+/* Returns the seconds from start to end, both from CLOCK_MONOTONIC.
+ */
+
+double time_seconds( const struct timeval* time );
+/* Returns a time from an rusage in seconds.
+ */
+
+void rusage_subtract( struct rusage* usage, const struct rusage* before );
+/* Takes the times and context switches in before from usage.
+ *
+ * usage is the later sample, which is changed
+ * before is the earlier sample
+ */
+
+///////////////////////////////////////////////////////////////////////////////
+//// Trace
+void trace_open( void );
+/* Opens the trace named by TRACE_ENV, closing any earlier one. A number is
+ * taken as an fd to write to, anything else as a file to append to. Unset
+ * or empty turns tracing off. Called at startup and by export.
+ */
+
+void trace_event( const char* event, pid_t child, const char* arg,
+    long value );
+/* Writes an event as one line of JSON, with the CLOCK_MONOTONIC time and
+ * the pid of the writer, which may be a forked child:
+ *
+ *   {"ts":12.000000345,"pid":100,"event":"fork","child":101,"arg":"ls",
+ *    "value":0}
  *
- * io_pipe_array must contain two elements.
+ * The events are start and end of the shell, line (value is the length),
+ * token (arg is the word, value the token_type), parse (value is the
+ * number of pipelines), fork and spawn (child, arg the command, value the
+ * stage), exec (from the child, arg the path), builtin (arg the name, value
+ * its status), wait (child, value the raw status), status (value the exit
+ * status of a pipeline), skip (value the index of a pipeline && or ||
+ * did not run), readdir (arg a directory a glob listed, value the
+ * entries), envp (value the entries, each time it is rebuilt), worker
+ * (child, value the idle workers after it was forked) and handoff (child
+ * the worker, arg the path, value the stage).
  *
- * io_pipe_array the array that will be printed
+ * Called through the trace macro, which is only a test of trace_fd while
+ * tracing is off.
+ *
+ * event is the name of the event
+ * child is the child it is about, or 0 to leave it out
+ * arg is a string to add, escaped, or NULL to leave it out
+ * value is a number for the event
  */
 
-void show_state( char* run_buffer_array[], int args_count );
-/* Prints the current state of the run_buffer_array
+///////////////////////////////////////////////////////////////////////////////
+//// Builtins
+const struct builtin* builtin_lookup( const char* name );
+/* Finds the builtin for a command. proc_pipeline checks this before it
+ * forks anything.
  *
- * args_count is the number of non-null elements in run_buffer_array and should
- *   be less than ARG_COUNT - 1.
+ * name is the command
  *
- * run_buffer_array is the array that will be printed
- * args_count is the number of element + 1, that should be printed.
+ * Returns the builtin or NULL if the command is not one.
+ */
+
+int builtin_cd( char* run_buffer_array[] );
+/* cd [dir]. Changes directory to dir, HOME with no argument or OLDPWD
+ * for -. PWD and OLDPWD are updated.
+ */
+
+int builtin_pwd( char* run_buffer_array[] );
+/* pwd. Prints the current directory.
+ */
+
+int builtin_echo( char* run_buffer_array[] );
+/* echo [-n] [arg ...]. Prints the arguments separated by spaces.
+ */
+
+int builtin_true( char* run_buffer_array[] );
+/* true. Returns 0.
+ */
+
+int builtin_false( char* run_buffer_array[] );
+/* false. Returns 1.
+ */
+
+int builtin_exit( char* run_buffer_array[] );
+/* exit [n]. Exits with status n, or that of the last pipeline. Does not
+ * return.
+ */
+
+int builtin_export( char* run_buffer_array[] );
+/* export [NAME[=value] ...]. Exports each NAME to the commands started
+ * after, setting it first if a value is given. With no arguments the
+ * environment is printed.
+ */
+
+int builtin_hash( char* run_buffer_array[] );
+/* hash [-r] [name ...]. See command_hash_builtin.
+ */
+
+int builtin_unset( char* run_buffer_array[] );
+/* unset NAME .... Removes each variable, exported or not.
+ */
+
+///////////////////////////////////////////////////////////////////////////////
+//// Pipeline Management
+struct pipeline* command_list_add_pipeline( struct command_list* list );
+/* Appends an empty pipeline to the list, growing the array as needed. The
+ * pipelines are kept between lines along with their stage arrays.
+ *
+ * list is the list to add to.
+ *
+ * Returns the new pipeline. It is only valid until the next call.
+ */
+
+void command_list_clear( struct command_list* list );
+/* Empties the list and resets its arena, releasing every argv of the
+ * line at once.
+ *
+ * list is the list that will be emptied
+ */
+
+void command_list_free( struct command_list* list );
+/* Frees the pipelines, stages and arena of a list that is done with, and
+ * zeroes it so it can be used again.
+ *
+ * list is the list to free
+ */
+
+struct stage* pipeline_add_stage( struct pipeline* pipeline,
+    struct arena* arena );
+/* Appends an empty stage to the pipeline, growing the stage array as needed.
+ * The stage array is kept between lines so it is only grown, never shrunk.
+ *
+ * pipeline is the pipeline to add to.
+ * arena is the arena of the line, the argv of the stage comes from it
+ *
+ * Returns the new stage. It is only valid until the next call.
+ */
+
+bool stage_empty( struct stage* stage );
+/* Checks if no command, argument or redirect has been parsed into a stage.
+ *
+ * stage is the stage to check
+ */
+
+int pipeline_close_fds( struct pipeline* pipeline );
+/* Closes the pipe ends held by every stage, leaving 0 and 1 alone.
+ *
+ * pipeline is the pipeline whose pipes will be closed.
+ *
+ * Returns 0 or -1 if any close failed.
+ */
+
+///////////////////////////////////////////////////////////////////////////////
+//// Per Line Arena
+void* arena_alloc( struct arena* arena, size_t size );
+/* Hands out size bytes, aligned for pointers, by bumping the current block.
+ * Blocks kept from earlier lines are reused before new ones are malloced,
+ * so once the arena has grown to fit a line no more memory is allocated.
+ *
+ * arena is the arena to allocate from, zeroed before its first use.
+ * size is the number of bytes wanted.
+ *
+ * Returns the memory, which lives until the next arena_reset.
+ */
+
+struct arena_block* arena_add_block( struct arena* arena,
+    struct arena_block* after, size_t size );
+/* Allocates a new block and links it into the chain.
+ *
+ * arena is the arena that will own the block.
+ * after is the block the new one follows. NULL makes it the head.
+ * size is the number of usable bytes in the block.
+ *
+ * Returns the new block.
+ */
+
+char* arena_strndup( struct arena* arena, const char* string, size_t length );
+/* Copies a string into the arena.
+ *
+ * arena is the arena to copy into
+ * string is the start of the characters to copy
+ * length is the number of characters to copy, a null is added after them
+ *
+ * Returns the null terminated copy.
+ */
+
+void arena_reset( struct arena* arena );
+/* Releases everything allocated from the arena in O(1). The blocks are not
+ * freed but kept for the next line.
+ *
+ * arena is the arena to reset.
+ */
+
+void arena_free( struct arena* arena );
+/* Frees every block of the arena, leaving it empty.
+ *
+ * arena is the arena to free.
+ */
+
+///////////////////////////////////////////////////////////////////////////////
+//// Memory Management of char *[]
+void null_run_array(char *[], int);
+/* Nulls all elements in run_buffer_array. Does NOT free the array
+ *
+ * run_buffer_array is the array that will be nulled
+ * size should be length of run_buffer_array
  */
 ///////////////////////////////////////////////////////////////////////////////
-#define debug if (DEBUG&1)
-#define debug_batch if (DEBUG&4)
-#define debug_verbose if (DEBUG&2)
+#define trace if ( executor.trace_fd != -1 ) trace_event
 ///////////////////////////////////////////////////////////////////////////////
 
 #ifndef TERMLANG_H
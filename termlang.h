@@ -15,62 +15,107 @@
 
 ///////////////////////////////////////////////////////////////////////////////
 //// Global error strings
+#define ARGUMENT_LIST_TOO_LONG "--sh: %s: argument list too long\n"
+#define CD_FAIL "--sh: cd: %s: %s\n"
+#define CD_NO_DIR "--sh: cd: HOME not set\n"
 #define CLOSE_PIPE_FAIL "--sh: exiting shell. Can't close internal pipes"
 #define COMMAND_NOT_FOUND "--sh: %s: command not found"
+#define HASH_NOT_FOUND "--sh: hash: %s: not found\n"
+#define EXPORT_FAIL "--sh: export: `%s': not a valid identifier\n"
+#define JOB_NO_CURRENT "--sh: %s: current: no such job\n"
+#define JOB_NOT_FOUND "--sh: %s: %s: no such job\n"
 #define FORK_FAIL "--sh: can't fork program"
+#define HEREDOC_EOF "--sh: warning: here-document ended by end of file (wanted `%s')\n"
+#define SPAWN_FAIL "--sh: %s: %s\n"
+#define OUT_OF_MEMORY "--sh: out of memory"
 #define NO_COMMAND_ERROR "--sh: %s: command not found"
-#define PFD_A_CLOSE_FAIL "--sh: Parent can't close internal pipe a"
-#define PFD_B_CLOSE_FAIL "--sh: Parent can't close internal pipe b"
+#define PARALLEL_NOT_PIPELINE "--sh: parallel: %s: not a single pipeline\n"
+#define PARALLEL_USAGE "--sh: parallel: usage: parallel [-j jobs] [-k] command ...\n"
+#define PARALLEL_WAIT_FAIL "--sh: parallel: can't wait for jobs"
+#define PLUMB_FAIL "--sh: %s: %s: %s\n"
+#define PIPE_SIZE_FAIL "--sh: can't set pipe size %zu: %s\n"
+#define PIPE_SIZE_INVALID "--sh: %s: invalid pipe size\n"
+#define PWD_FAIL "--sh: pwd: %s\n"
 #define PFD_OPEN_ERROR "--sh: can't create internal pipes"
 #define PFD_CLOSE_ERROR "--sh: can't close internal pipes"
+#define SCRIPT_OPEN_ERROR "--sh: %s: %s\n"
+#define TRACE_OPEN_ERROR "--sh: trace: %s: %s\n"
 #define STDIN_CLOSE_ERROR "--sh: can't redirect stdin"
-#define STDIN_OPEN_ERROR "--sh: can't redirect stdin to a file"
 #define STDOUT_CLOSE_ERROR "--sh: can't redirect stdout"
-#define STDOUT_OPEN_ERROR "--sh: can't redirect stdout to a file"
+#define REDIRECT_ERROR "--sh: can't redirect"
+#define WORKER_CHDIR_ERROR "--sh: worker can't change directory"
+#define REDIRECT_FAIL "--sh: %d: %s\n"
+#define BAD_FD "--sh: %s: bad file descriptor\n"
+#define UNEXPECTED_TOKEN "--sh: syntax error near unexpected token `%s'\n"
 #define UNEXPECTED_EOL "--sh: syntax error near unexpected token `newline'\n"
 
 ///////////////////////////////////////////////////////////////////////////////
-//// Global debug strings
-#define DEBUG_STRING_CUR_POS "--sh: current position %d\n"
-#define DEBUG_STRING_CUR_INPUT "--sh: input is > %s\n"
+//// Trace output
+#define TRACE_HEAD "{\"ts\":%ld.%09ld,\"pid\":%d,\"event\":\"%s\""
+#define TRACE_CHILD ",\"child\":%d"
+#define TRACE_ARG ",\"arg\":\""
+#define TRACE_ESCAPE "\\u%04x"
+#define TRACE_VALUE ",\"value\":%ld}\n"
 
-#define DEBUG_STRING_NEWLINE_FOUND "--sh: 'newline' found\n"
-#define DEBUG_STRING_PIPE_FOUND "\n--sh: pipe symbol '|' located\n\n"
-#define DEBUG_STRING_LESS_FOUND "\n--sh: pipe symbol '<' located\n\n"
-#define DEBUG_STRING_MORE_FOUND "\n--sh: pipe symbol '>' located\n\n"
-#define DEBUG_STRING_NEWLINE_DELIMIT "--sh: parsing case a, string delimiter '\n"
-#define DEBUG_STRING_QUOTE_DELIMIT "-sh: parsing case b, string delimiter \"'n"
-#define DEBUG_STRING_SPACE_DELIMIT "--sh: parsing case c, string delimiter ' '\n"
-
-#define DEBUG_STRING_REMOVING_WHITESPACE "--sh: removing whitespace\n"
-
-#define DEBUG_STRING_FORK_START "--sh: Fork started\n"
-#define DEBUG_STRING_NO_PIPE "--sh: Flags=NO_PIPE>\n\n"
-#define DEBUG_STRING_PIPE_CONTA "--sh: Flags=PIPE_CONTA>\n\n"
-#define DEBUG_STRING_PIPE_CONTB "--sh: Flags=PIPE_CONTB>\n\n"
-#define DEBUG_STRING_PIPE_DRAINA "--sh: Flags=PIPE_DRAINA>\n\n"
-#define DEBUG_STRING_PIPE_DRAINB "--sh: Flags=PIPE_DRAINB>\n\n"
-#define DEBUG_STRING_FORK_END "--sh: ending proc_fork call\n"
-#define DEBUG_STRING_PIPE_START "--sh Flags=PIPE_START>\n\n"
-
-#define DEBUG_STRING_COMMAND_OUT_CALL "--sh: calling command_out [%d,%d]\n"
-#define DEBUG_STRING_CUR_ARG "--sh: reading in argument %d\n"
-#define DEBUG_STRING_CUR_CMD "--sh: reading in command \n"
-
-#define DEBUG_STRING_CONTAIN_CTRL_D "--sh: input contains ^d. Exiting.\n\n"
-#define DEBUG_STRING_NO_CONTAIN_CTRL_D "--sh: input does not contain ^d\n"
+#define TRACE_BUILTIN "builtin"
+#define TRACE_CACHE "cache"
+#define TRACE_END "end"
+#define TRACE_ENVP "envp"
+#define TRACE_EXEC "exec"
+#define TRACE_FORK "fork"
+#define TRACE_HANDOFF "handoff"
+#define TRACE_LINE "line"
+#define TRACE_PARSE "parse"
+#define TRACE_READDIR "readdir"
+#define TRACE_SKIP "skip"
+#define TRACE_SPAWN "spawn"
+#define TRACE_START "start"
+#define TRACE_STATUS "status"
+#define TRACE_TOKEN "token"
+#define TRACE_WAIT "wait"
+#define TRACE_WORKER "worker"
 
 ///////////////////////////////////////////////////////////////////////////////
 //// Message output
-#define ARGUMENT "Argument %d: %s\n"
-#define COMMAND "Command: %s\n"
-#define FILE_IO "File IO:\n"
-#define INPUT_FILE "Input file: %s\n"
-#define LANGUAGE_SELECT "Language selected %s\n"
-#define OUTPUT_FILE "Output file: %s\n"
+#define HASH_HEADER "hits\tcommand\n"
+#define HASH_ENTRY "%4u\t%s\n"
+#define HASH_EMPTY "hash: hash table empty\n"
+#define EXPORT_ENTRY "export %s\n"
+#define JOB_ENTRY "[%d]%c  %-24s%s\n"
+#define JOB_RESUMED "[%d]+ %s\n"
+#define JOB_STARTED "[%d] %d\n"
+#define JOB_DONE_STRING "Done"
+#define JOB_RUNNING_STRING "Running"
+#define JOB_STOPPED_STRING "Stopped"
+#define TIME_HEADER "stage      real      user       sys    maxrss   vcsw  ivcsw  command\n"
+#define TIME_STAGE "%5d %9.6f %9.6f %9.6f %9s %6ld %6ld  %s\n"
+#define TIME_MAXRSS "%ldk"
+#define TIME_NO_MAXRSS "-"
+#define TIME_SHELL "shell     parse %.6f  spawn %.6f\n"
+#define TIME_TOTAL "real\t%.3fs\nuser\t%.3fs\nsys\t%.3fs\n"
 
+#define BG_STRING "bg"
+#define CD_STRING "cd"
+#define ECHO_STRING "echo"
 #define EXIT_STRING "exit"
+#define EXPORT_STRING "export"
+#define FALSE_STRING "false"
+#define FG_STRING "fg"
+#define HASH_STRING "hash"
+#define JOBS_STRING "jobs"
+#define PARALLEL_STRING "parallel"
+#define PCAT_STRING "pcat"
+#define PTEE_STRING "ptee"
+#define PIPESIZE_STRING "pipesize"
+#define PWD_STRING "pwd"
+#define TIME_STRING "time"
+#define TRUE_STRING "true"
+#define UNSET_STRING "unset"
+#define WAIT_STRING "wait"
 #define PROMPT_STRING "> "
+#define HEREDOC_PROMPT "> "
+#define HEREDOC_NAME "here-document"
+#define PROCESS_PATH "/dev/fd/%d"
 ///////////////////////////////////////////////////////////////////////////////
 
 #endif